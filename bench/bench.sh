@@ -0,0 +1,219 @@
+#!/bin/sh
+# $Id: bench.sh $
+#
+# End to end benchmark for c2ps and count.
+#
+# usage: bench.sh [-golden | -baseline]
+#
+# Generates the corpus into bench/corpus (once), runs every case in
+# CASES below BENCH_RUNS times and keeps the fastest run, then
+#
+#   - checks each case's output against bench/golden (cksum and length);
+#     any difference fails, so speed work can't change what is printed
+#   - compares MB/s, pages/s, peak RSS and output bytes with
+#     bench/baseline, if there is one, and fails if any is worse by more
+#     than BENCH_THRESHOLD percent
+#
+# -golden rewrites bench/golden from this run, for when the output is
+# meant to change.  -baseline writes bench/baseline.  A baseline is only
+# meaningful on the machine it was recorded on, so none is kept with the
+# sources: record one before making changes, and again when the output
+# is meant to grow.  Results of the last run are left in bench/out.
+#
+# Environment: C2PS and COUNT (default ./c2ps and ./count), BENCH_RUNS
+# (3), BENCH_THRESHOLD (10).
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+CORPUS=$HERE/corpus
+OUT=$HERE/out
+RUNS=${BENCH_RUNS:-3}
+THRESHOLD=${BENCH_THRESHOLD:-10}
+MODE=$1
+
+abspath() {
+    echo "$(cd "$(dirname "$1")" && pwd)/$(basename "$1")"
+}
+
+C2PS=$(abspath "${C2PS:-./c2ps}")
+COUNT=$(abspath "${COUNT:-./count}")
+RUNSTAT=$HERE/runstat
+
+for prog in "$C2PS" "$COUNT" "$RUNSTAT"; do
+    if [ ! -x "$prog" ]; then
+        echo "bench: no $prog, run make first" >&2
+        exit 2
+    fi
+done
+
+# dates in the output come from here instead of the clock and file times
+SOURCE_DATE_EPOCH=946684800
+export SOURCE_DATE_EPOCH
+
+#
+# the corpus: file kind KB seed, generated by gencorpus.awk
+#
+CORPUS_FILES="
+prog.c          c           2048    1
+prog.cpp        cpp         2048    2
+model.v         verilog     1024    3
+model.vr        vera        1024    4
+model.trellis   trellis     1024    5
+log.txt         text        4096    6
+tables.c        longline    2048    7
+nest.c          nest        1024    8
+comments.c      comment     2048    9
+huge.c          c           32768   10
+"
+
+# (again when gencorpus.awk changes, as the golden sums follow it)
+if [ ! -f "$CORPUS/.done" ] || [ "$HERE/gencorpus.awk" -nt "$CORPUS/.done" ]; then
+    echo "bench: generating corpus in $CORPUS"
+    mkdir -p "$CORPUS" || exit 2
+    echo "$CORPUS_FILES" | while read -r file kind kb seed; do
+        [ -n "$file" ] || continue
+        awk -v kind=$kind -v size=$((kb * 1024)) -v seed=$seed \
+            -f "$HERE/gencorpus.awk" > "$CORPUS/$file" || exit 2
+    done || exit 2
+    touch "$CORPUS/.done"
+fi
+
+ALL="prog.c prog.cpp model.v model.vr model.trellis log.txt tables.c nest.c comments.c"
+
+#
+# the cases: name program arguments...; c2ps output goes to -o name.ps,
+# count output to name.out.  c2ps-stdin is c2ps given its last argument
+# on standard input, for compressed output: the page headers in it can't
+# be told apart from the rest to take the directory out of the file name.
+#
+CASES="
+c2ps-c          c2ps    prog.c
+c2ps-cpp        c2ps    prog.cpp
+c2ps-verilog    c2ps    model.v
+c2ps-vera       c2ps    model.vr
+c2ps-trellis    c2ps    model.trellis
+c2ps-text       c2ps    log.txt
+c2ps-longline   c2ps    tables.c
+c2ps-nest       c2ps    nest.c
+c2ps-comment    c2ps    comments.c
+c2ps-huge       c2ps    huge.c
+c2ps-huge-flate c2ps-stdin -compact -flate -c huge.c
+c2ps-all-fixed  c2ps    -fixed -4 $ALL
+count-all       count   $ALL
+count-all-j4    count   -j 4 $ALL
+count-huge      count   huge.c
+count-huge-j4   count   -j 4 huge.c
+count-exact     count   -exact $ALL
+"
+
+rm -rf "$OUT"
+mkdir -p "$OUT" || exit 2
+cd "$CORPUS" || exit 2
+
+printf "%-16s %9s %10s %9s %11s\n" case MB/s pages/s "RSS KB" "out bytes"
+
+echo "$CASES" | while read -r name prog args; do
+    [ -n "$name" ] || continue
+    inbytes=0
+    for a in $args; do
+        [ -f "$a" ] && inbytes=$((inbytes + $(wc -c < "$a")))
+    done
+    best=
+    rss=0
+    i=0
+    while [ $i -lt $RUNS ]; do
+        if [ $prog = c2ps ]; then
+            stat=$("$RUNSTAT" "$C2PS" -o "$OUT/$name.ps" $args) || exit 1
+        elif [ $prog = c2ps-stdin ]; then
+            stat=$("$RUNSTAT" "$C2PS" -o "$OUT/$name.ps" ${args% *} - < ${args##* }) || exit 1
+        else
+            stat=$("$RUNSTAT" -o "$OUT/$name.out" "$COUNT" $args) || exit 1
+        fi
+        set -- $stat
+        best=$(echo "$1 $best" | awk '{ print (NF == 1 || $1 < $2) ? $1 : $2 }')
+        [ $2 -gt $rss ] && rss=$2
+        i=$((i + 1))
+    done
+
+    # pages: from the DSC trailer, or count's last (total) line
+    if [ $prog != count ]; then
+        output=$OUT/$name.ps
+        pages=$(awk '/^%%Pages: [0-9]/ { n = $2 } END { print n + 0 }' "$output")
+        # the title and the file names in the page headers are made
+        # absolute, and a header name is placed by its width, so take out
+        # the directory and the x that goes with it; the creator and
+        # creation date depend on how c2ps was run
+        sed -e '/^%%Creator:/d' -e '/^%%Title:/d' -e '/^%%CreationDate:/d' \
+            -e "s|($CORPUS/\([^)]*\))[0-9.]*|(\1)|g" "$output" > "$OUT/$name.cmp"
+    else
+        output=$OUT/$name.out
+        # (a 5 digit page count runs into the name)
+        pages=$(awk 'END { for (i = 2; i <= NF; i++)
+                               if ($i ~ /^pages?$/ && match($(i - 1), /[0-9]+$/))
+                                   print substr($(i - 1), RSTART) }' "$output")
+        cp "$output" "$OUT/$name.cmp"
+    fi
+    outbytes=$(wc -c < "$output")
+    echo "$name $(cksum < "$OUT/$name.cmp")" >> "$OUT/golden"
+    rm -f "$OUT/$name.cmp"
+    echo "$name $best $inbytes $pages $rss $outbytes" |
+        awk '{ printf "%-16s %9.2f %10.1f %9d %11d\n", $1, $3 / 1e6 / $2, $4 / $2, $5, $6 }' |
+        tee -a "$OUT/results"
+done || exit 1
+
+case "$MODE" in
+-golden)
+    cp "$OUT/golden" "$HERE/golden"
+    echo "bench: wrote $HERE/golden"
+    exit 0
+    ;;
+esac
+
+status=0
+if [ ! -f "$HERE/golden" ]; then
+    echo "bench: no golden file, make one with bench.sh -golden" >&2
+    status=1
+elif ! diff "$HERE/golden" "$OUT/golden" > "$OUT/golden.diff"; then
+    echo "bench: FAIL output differs from golden for:" >&2
+    awk '/^>/ { print "    " $2 }' "$OUT/golden.diff" >&2
+    status=1
+fi
+
+case "$MODE" in
+-baseline)
+    if [ $status = 0 ]; then
+        cp "$OUT/results" "$HERE/baseline"
+        echo "bench: wrote $HERE/baseline"
+    fi
+    exit $status
+    ;;
+esac
+
+if [ ! -f "$HERE/baseline" ]; then
+    echo "bench: no baseline on this machine, so speed and size went unchecked;" >&2
+    echo "bench: record one with bench.sh -baseline (make bench-baseline)" >&2
+    [ $status = 0 ] && echo "bench: output ok"
+    exit $status
+fi
+
+# fields: name MB/s pages/s rss bytes; rates must not drop, sizes not grow
+awk -v t=$THRESHOLD '
+    FNR == NR { for (i = 2; i <= 5; i++) base[$1, i] = $i; next }
+    {
+        split("MB/s pages/s RSS(KB) bytes", what, " ")
+        for (i = 2; i <= 5; i++) {
+            if (!(($1, i) in base))
+                continue
+            b = base[$1, i]
+            if (b == 0)
+                continue
+            change = ($i - b) * 100 / b
+            if ((i <= 3) ? (change < -t) : (change > t)) {
+                printf "bench: FAIL %s %s %s, baseline %s (%+.1f%%)\n", $1, what[i - 1], $i, b, change
+                bad = 1
+            }
+        }
+    }
+    END { exit bad }' "$HERE/baseline" "$OUT/results" >&2 || status=1
+
+[ $status = 0 ] && echo "bench: ok (threshold $THRESHOLD%)"
+exit $status
@@ -0,0 +1,74 @@
+#!/bin/sh
+# $Id: emit.sh $
+#
+# Time how fast c2ps gets its PostScript out: one large C file (16 MB,
+# from gencorpus.awk) rendered by one thread into a file and into a pipe,
+# best of BENCH_RUNS runs, as MB/s of source read and of PostScript
+# written.  Each argument is a c2ps binary, or a git revision to build
+# one from, so output speed can be compared before and after a change:
+#
+#   emit.sh ./c2ps d41f732~1
+#
+# (make bench-emit BEFORE=d41f732~1 does the same.)
+#
+# usage: emit.sh c2ps-or-revision...
+#
+# Environment: BENCH_RUNS (3).
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+RUNSTAT=$HERE/runstat
+RUNS=${BENCH_RUNS:-3}
+TMP=${TMPDIR:-/tmp}/emit.$$
+
+trap 'rm -rf $TMP' 0 1 2 15
+mkdir -p $TMP || exit 1
+
+if [ $# = 0 ]; then
+    echo "usage: $0 c2ps-or-revision..." >&2
+    exit 2
+fi
+if [ ! -x "$RUNSTAT" ]; then
+    echo "emit: no $RUNSTAT, run make bench/runstat first" >&2
+    exit 2
+fi
+
+SOURCE_DATE_EPOCH=946684800
+export SOURCE_DATE_EPOCH
+
+awk -v kind=c -v size=$((16384 * 1024)) -v seed=10 \
+    -f "$HERE/gencorpus.awk" > $TMP/huge.c || exit 1
+inbytes=$(wc -c < $TMP/huge.c)
+
+# best runstat...: the fastest time of RUNS runs
+best() {
+    i=0
+    min=
+    while [ $i -lt $RUNS ]; do
+        stat=$("$@") || exit 1
+        min=$(echo "$stat $min" | awk '{ print (NF == 2 || $1 < $3) ? $1 : $3 }')
+        i=$((i + 1))
+    done
+    echo $min
+}
+
+printf "%-24s %9s %9s %9s %9s\n" c2ps "file in" "file out" "pipe in" "pipe out"
+n=0
+for arg in "$@"; do
+    n=$((n + 1))
+    if [ -x "$arg" ]; then
+        c2ps=$arg
+    else
+        # a revision: build its c2ps the way its own Makefile does
+        mkdir -p $TMP/rev$n || exit 1
+        (cd "$HERE/.." && git archive "$arg") | tar -x -C $TMP/rev$n || exit 1
+        make -s -C $TMP/rev$n BIN=. ./c2ps > /dev/null || exit 1
+        c2ps=$TMP/rev$n/c2ps
+    fi
+
+    tfile=$(best "$RUNSTAT" "$c2ps" -o $TMP/out.ps $TMP/huge.c) || exit 1
+    outbytes=$(wc -c < $TMP/out.ps)
+    tpipe=$(best "$RUNSTAT" sh -c '"$0" -o - "$1" | cat > /dev/null' "$c2ps" $TMP/huge.c) || exit 1
+    echo "$arg $inbytes $outbytes $tfile $tpipe" |
+        awk '{ printf "%-24s %9.1f %9.1f %9.1f %9.1f\n", $1,
+                      $2 / 1e6 / $4, $3 / 1e6 / $4, $2 / 1e6 / $5, $3 / 1e6 / $5 }'
+done
@@ -0,0 +1,57 @@
+#!/bin/sh
+# $Id: funcscan.sh $
+#
+# Time c2ps function-name detection on inputs that used to make it rescan
+# the same text once per identifier: wide initializer tables, long
+# macro-heavy prototypes and deeply nested calls, each at doubling sizes.
+# With detection linear in the input, us/ident stays flat as n grows.
+#
+# usage: funcscan.sh [c2ps binary] [largest n]
+
+C2PS=${1:-./c2ps}
+MAX=${2:-16000}
+TMP=${TMPDIR:-/tmp}/funcscan.$$
+
+trap 'rm -rf $TMP' 0 1 2 15
+mkdir -p $TMP || exit 1
+
+# gen shape n: write a C file of the given shape with n identifiers
+gen() {
+    awk -v shape=$1 -v n=$2 'BEGIN {
+        if (shape == "table") {
+            printf "static const struct entry table[] = {"
+            for (i = 0; i < n; i++)
+                printf " ENTRY(%d, name%d, FLAGS(f%d)),", i, i, i
+            printf " };\n"
+        } else if (shape == "proto") {
+            printf "EXPORT API_CALL(int) WINAPI handler("
+            for (i = 0; i < n; i++)
+                printf "%sIN_OPT ANNOTATE(a%d) TYPE(t%d) p%d", i ? ",\n    " : "", i, i, i
+            printf ");\n"
+        } else {
+            printf "int value = "
+            for (i = 0; i < n; i++)
+                printf "WRAP%d(", i % 7
+            printf "0"
+            for (i = 0; i < n; i++)
+                printf ")"
+            printf ";\n"
+        }
+        for (i = 0; i < 30; i++)
+            printf "int f%d(int a)\n{\n    return g(a);\n}\n", i
+    }'
+}
+
+printf "%-8s %8s %10s %10s\n" shape n seconds us/ident
+for shape in table proto nested; do
+    n=1000
+    while [ $n -le $MAX ]; do
+        gen $shape $n > $TMP/$shape.c
+        start=$(date +%s.%N)
+        $C2PS -o /dev/null $TMP/$shape.c || exit 1
+        end=$(date +%s.%N)
+        echo "$shape $n $start $end" |
+            awk '{ t = $4 - $3; printf "%-8s %8d %10.3f %10.3f\n", $1, $2, t, t * 1e6 / $2 }'
+        n=$((n * 2))
+    done
+done
@@ -0,0 +1,298 @@
+# $Id: gencorpus.awk $
+#
+# Write one synthetic benchmark input to stdout.
+#
+#   awk -v kind=K -v size=BYTES -v seed=N -f gencorpus.awk
+#
+# kind is one of c, cpp, verilog, vera, trellis, text, longline, nest or
+# comment.  Output stops at the first line break past size bytes.  The
+# random numbers come from a Park-Miller generator done in integers that
+# fit a double exactly, so every awk writes the same bytes for a seed.
+
+function rnd(n) {
+    seed = (seed * 16807) % 2147483647
+    return int(seed / 2147483647 * n)
+}
+
+function pick(list, n) {
+    return list[1 + rnd(n)]
+}
+
+function emit(s) {
+    printf "%s", s
+    bytes += length(s)
+}
+
+function ident() {
+    return pick(idents, nidents) (rnd(3) ? "" : "_" rnd(64))
+}
+
+function words(n,   s, i) {
+    s = pick(text, ntext)
+    for (i = 1; i < n; i++)
+        s = s " " pick(text, ntext)
+    return s
+}
+
+#
+# C and C++
+#
+function expr(d,   r) {
+    r = rnd(7)
+    if (d > 3 || r == 0)
+        return ident()
+    if (r == 1)
+        return rnd(4096)
+    if (r == 2)
+        return expr(d + 1) " " pick(ops, nops) " " expr(d + 1)
+    if (r == 3)
+        return ident() "(" args(d + 1) ")"
+    if (r == 4)
+        return "\"" words(1 + rnd(5)) (rnd(4) ? "" : " (%d)\\n") "\""
+    if (r == 5)
+        return ident() "[" expr(d + 1) "]"
+    return "(" expr(d + 1) ")"
+}
+
+function args(d,   n, s, i) {
+    n = rnd(5)
+    s = ""
+    for (i = 0; i < n; i++)
+        s = s (i ? ", " : "") expr(d)
+    return s
+}
+
+function c_comment(ind) {
+    if (kind == "cpp" && rnd(2))
+        emit(ind "// " words(3 + rnd(9)) "\n")
+    else
+        emit(ind "/* " words(3 + rnd(9)) " */\n")
+}
+
+function c_stmt(ind, depth,   r) {
+    r = rnd(12)
+    if (kind == "nest" && 6 <= r && r < 10)
+        r = 4                   # nest_block() does the nesting
+    if (r < 4)
+        emit(ind ident() " " pick(assigns, nassigns) " " expr(0) ";" (rnd(5) ? "" : "\t/* " words(2 + rnd(4)) " */") "\n")
+    else if (r < 5)
+        c_comment(ind)
+    else if (r < 6)
+        emit(ind ident() "(" args(0) ");\n")
+    else if (r < 7 && depth < maxdepth) {
+        emit(ind "if (" expr(0) ") {\n")
+        c_block(ind "\t", depth + 1)
+        if (rnd(2)) {
+            emit(ind "} else {\n")
+            c_block(ind "\t", depth + 1)
+        }
+        emit(ind "}\n")
+    } else if (r < 8 && depth < maxdepth) {
+        emit(ind "for (" ident() " = 0; " ident() " < " expr(1) "; " ident() "++) {\n")
+        c_block(ind "\t", depth + 1)
+        emit(ind "}\n")
+    } else if (r < 9 && depth < maxdepth) {
+        emit(ind "while (" expr(0) ")\n")
+        c_stmt(ind "    ", depth + 1)
+    } else if (r < 10 && depth < maxdepth) {
+        emit(ind "switch (" ident() ") {\n")
+        emit(ind "case " rnd(16) ":\n")
+        c_block(ind "\t", depth + 1)
+        emit(ind "\tbreak;\n" ind "default:\n" ind "\treturn " expr(1) ";\n" ind "}\n")
+    } else if (r < 11)
+        emit("\n")
+    else
+        emit(ind "return " expr(0) ";\n")
+}
+
+function c_block(ind, depth,   n, i) {
+    n = 1 + rnd(5)
+    for (i = 0; i < n; i++)
+        c_stmt(ind, depth)
+    if (kind == "nest" && depth < maxdepth)
+        nest_block(ind, depth)
+}
+
+#
+# one statement per level down to maxdepth, with parens nesting as deep
+#
+function nest_block(ind, depth,   i, lhs, rhs) {
+    lhs = ""
+    rhs = ""
+    for (i = 0; i < depth; i++) {
+        lhs = lhs ident() "("
+        rhs = rhs ")"
+    }
+    emit(ind "if (" lhs expr(1) rhs ") {\n")
+    c_block(ind "\t", depth + 1)
+    emit(ind "}\n")
+}
+
+function params(   n, s, i) {
+    n = rnd(5)
+    if (n == 0)
+        return "void"
+    s = ""
+    for (i = 0; i < n; i++)
+        s = s (i ? ", " : "") pick(types, ntypes) " " (rnd(3) ? "" : "*") ident()
+    return s
+}
+
+function c_func(   name) {
+    name = ident()
+    emit("\n/*\n * " words(4 + rnd(8)) "\n * " words(4 + rnd(8)) "\n */\n")
+    if (kind == "cpp" && rnd(3) == 0)
+        name = pick(classes, nclasses) "::" name
+    emit((rnd(2) ? "static " : "") pick(types, ntypes) "\n" name "(" params() ")\n{\n")
+    if (nfuncs++ % 4 == 0)      # not from rnd(), so the rest stays as it was
+        emit("\t" literals[1 + int(nfuncs / 4) % nliterals] "\n")
+    if (rnd(2))
+        emit("\t" pick(types, ntypes) " " ident() ", " ident() " = " rnd(100) ";\n\n")
+    c_block("\t", 1)
+    emit("}\n")
+}
+
+function cpp_class(   name, n, i) {
+    name = pick(classes, nclasses)
+    emit("\ntemplate <class T>\nclass " name " : public " pick(classes, nclasses) "<T> {\npublic:\n")
+    emit("\t" name "();\n\tvirtual ~" name "();\n")
+    n = 2 + rnd(6)
+    for (i = 0; i < n; i++)
+        emit("\tvirtual " pick(types, ntypes) " " ident() "(" params() ") const;\t// " words(2 + rnd(5)) "\n")
+    emit("private:\n\tstd::vector<T> " ident() ";\n\tstd::map<std::string, int> " ident() ";\n};\n")
+}
+
+function c_file() {
+    emit("/*\n * " words(6) "\n */\n\n#include <stdio.h>\n#include \"" ident() ".h\"\n\n")
+    emit("#define " toupper(ident()) "(x)\t((x) * " rnd(64) ")\n")
+    while (bytes < size) {
+        if (kind == "cpp" && rnd(4) == 0)
+            cpp_class()
+        else if (kind == "comment" || rnd(8) == 0) {
+            emit("\n/*\n")
+            n = 3 + rnd(kind == "comment" ? 40 : 8)
+            for (i = 0; i < n; i++)
+                emit(" * " words(4 + rnd(10)) "\n")
+            emit(" */\n")
+            if (kind == "comment")
+                for (i = 0; i < 4; i++)
+                    c_comment("")
+        }
+        c_func()
+    }
+}
+
+#
+# initializer tables with lines from a few hundred bytes to ~100k
+#
+function longline_file(   n, i, len) {
+    while (bytes < size) {
+        emit("\nstatic const int " ident() "[] = {")
+        len = 64 * (1 + rnd(rnd(8) ? 16 : 256))
+        for (i = 0; i < len; i++)
+            emit(" " rnd(65536) ",")
+        emit(" };\n")
+        c_func()
+    }
+}
+
+#
+# Verilog, Vera and Trellis
+#
+function verilog_file(   n, i) {
+    while (bytes < size) {
+        emit("\n// " words(4 + rnd(8)) "\nmodule " ident() " (\n\tinput wire clk,\n\tinput wire rst,\n")
+        emit("\tinput wire [" rnd(64) ":0] " ident() ",\n\toutput reg [7:0] q\n);\n")
+        emit("\treg [31:0] " ident() ";\n\twire " ident() " = " ident() " & " ident() ";\n\n")
+        emit("\talways @(posedge clk or negedge rst) begin\n\t\tif (!rst)\n\t\t\tq <= 8'h0;\n\t\telse begin\n")
+        n = 1 + rnd(8)
+        for (i = 0; i < n; i++)
+            emit("\t\t\t" ident() " <= " ident() " " pick(ops, nops) " " rnd(256) ";\t// " words(2 + rnd(4)) "\n")
+        emit("\t\tend\n\tend\n\n\tassign " ident() " = (" ident() " == 4'd" rnd(16) ") ? " ident() " : " ident() ";\nendmodule\n")
+    }
+}
+
+function vera_file(   n, i) {
+    while (bytes < size) {
+        emit("\nclass " pick(classes, nclasses) " extends " pick(classes, nclasses) " {\n\tinteger " ident() ";\n\tbit [31:0] " ident() ";\n")
+        emit("\n\ttask " ident() "(integer " ident() ") {\n")
+        n = 1 + rnd(6)
+        for (i = 0; i < n; i++)
+            emit("\t\t" ident() " = " expr(1) ";\t/* " words(2 + rnd(4)) " */\n")
+        emit("\t\tif (" ident() " > " rnd(99) ")\n\t\t\tprintf(\"" words(3) " %d\\n\", " ident() ");\n\t}\n}\n")
+        emit("program " ident() " { " ident() " = new; fork " ident() "(); join all }\n")
+    }
+}
+
+function trellis_file(   n, i) {
+    while (bytes < size) {
+        emit("\ntype_module " ident() " is ! " words(2 + rnd(6)) "\n")
+        n = 1 + rnd(4)
+        for (i = 0; i < n; i++) {
+            emit("  operation " ident() "(a: Integer; b: Integer) returns (Integer) is\n")
+            emit("    begin\n      if a mod b = 0 and a > " rnd(100) " then ! " words(3) "\n")
+            emit("        return a div b;\n      end if;\n      return a xor b;\n    end " ident() ";\n")
+        }
+        emit("end " ident() ";\n")
+    }
+}
+
+#
+# a program log, some lines with tabs and parens
+#
+function text_file(   t) {
+    t = 0
+    while (bytes < size) {
+        t += rnd(1000)
+        emit(sprintf("%02d:%02d:%02d.%03d %-5s [%s] %s", int(t / 3600000) % 24, int(t / 60000) % 60, int(t / 1000) % 60, t % 1000, \
+            pick(levels, nlevels), ident(), words(3 + rnd(12))))
+        if (rnd(5) == 0)
+            emit("\t(" ident() "=" rnd(100000) ")")
+        emit("\n")
+        if (rnd(200) == 0)
+            emit("\f\n")
+    }
+}
+
+BEGIN {
+    seed = seed + 0
+    if (seed <= 0)
+        seed = 1
+    size = size + 0
+    maxdepth = (kind == "nest") ? 48 : 4
+    nidents = split("buf len count index node next prev head tail value key table state flags " \
+        "offset size ptr result error line page col width height font name data tmp entry list " \
+        "hash map queue lock mask bits src dst parse scan emit render layout cursor limit", idents, " ")
+    ntypes = split("int unsigned long char* size_t void double struct_node* const_char* bool", types, " ")
+    nops = split("+ - * / % & | ^ << >> == != < > <= >= && ||", ops, " ")
+    nassigns = split("= += -= |= &= =", assigns, " ")
+    nclasses = split("Buffer Reader Writer Parser Layout Page Font Table Cache Node", classes, " ")
+    nlevels = split("INFO DEBUG WARN ERROR TRACE", levels, " ")
+    ntext = split("the a of to and in is it for that with on as by this be are from or at " \
+        "page line font width buffer input output file count render layout scan table entry " \
+        "value result before after when each every first last next only more less fast slow", text, " ")
+    # words run into quotes: digit separators, prefixed literals and a
+    # word that goes on after a string
+    nliterals = 0
+    literals[++nliterals] = "long n = 1'000'000;"
+    literals[++nliterals] = "x = u8\"ab\"cd;"
+    literals[++nliterals] = "x = a\"s\"bc;"
+    literals[++nliterals] = "const wchar_t *w = L\"wide\", c = L'c';"
+    literals[++nliterals] = "mask = 0xFFFF'FFFFull, bits = 0b1010'0101;"
+    literals[++nliterals] = "s = u\"page line\" U\"font\"_sv;"
+    nfuncs = 0
+    bytes = 0
+
+    if (kind == "verilog")
+        verilog_file()
+    else if (kind == "vera")
+        vera_file()
+    else if (kind == "trellis")
+        trellis_file()
+    else if (kind == "text")
+        text_file()
+    else if (kind == "longline")
+        longline_file()
+    else
+        c_file()
+}
@@ -0,0 +1,121 @@
+/*
+ * $Header: kwfind.cpp $
+ *
+ * Time keyword lookup: the perfect hash tables KwFind() searches against
+ * the linear strcmp() scan of the keyword list that IsKeyword() used to
+ * do, for each built in language, on the same identifiers.  About a
+ * quarter of them are keywords of the language and the rest are random
+ * identifiers.  Both methods must agree on every one of them.
+ *
+ * c2ps.cpp is included whole so the harness sees the same tables c2ps is
+ * built with.
+ *
+ * usage: kwfind [identifiers]
+ */
+
+#define main c2ps_main
+#include "../c2ps.cpp"
+#undef main
+
+#include <time.h>
+
+static const struct {
+    const char *name;
+    int language;
+    const char *const *words;
+} kw_languages[] = {
+        {"C",       LANG_C,       c_keywords},
+        {"C++",     LANG_CPP,     cpp_keywords},
+        {"Trellis", LANG_TRELLIS, trellis_keywords},
+        {"Verilog", LANG_VERILOG, verilog_keywords},
+        {"Vera",    LANG_VERA,    vera_keywords}};
+
+/*
+ * the old IsKeyword(): walk the list until a word compares equal
+ */
+static int LinearFind(const char *const *words, const char *kword) {
+    for (const char *const *ptr = words; *ptr != NULL; ptr++)
+        if (strcmp(*ptr, kword) == 0)
+            return ptr - words;
+    return -1;
+}
+
+static double Seconds() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv) {
+    static const char first[] = "abcdefghijklmnopqrstuvwxyz_",
+            rest[] = "abcdefghijklmnopqrstuvwxyz_0123456789";
+    long n = (argc > 1) ? atol(argv[1]) : 2000000;
+    char *text;
+    const char **ident;
+    int *len;
+    unsigned seed = 1;
+
+    if (n <= 0) {
+        fprintf(stderr, "usage: %s [identifiers]\n", argv[0]);
+        return 1;
+    }
+    text = (char *) malloc(n * (KW_MAX_LEN + 1));
+    ident = (const char **) malloc(n * sizeof(*ident));
+    len = (int *) malloc(n * sizeof(*len));
+    if (text == NULL || ident == NULL || len == NULL) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return 1;
+    }
+
+    printf("%-8s %10s %10s %10s %8s\n", "language", "keywords", "scan ns", "hash ns", "speedup");
+    for (const auto &lang : kw_languages) {
+        const keyword_lookup_t *kt = &keyword_lookup[lang.language];
+        size_t nwords = KwCount(lang.words);
+        long found = 0, sum_scan = 0, sum_hash = 0;
+        double t0, t1, t2;
+
+        for (long i = 0; i < n; i++) {
+            char *w = text + i * (KW_MAX_LEN + 1);
+
+            seed = seed * 1103515245 + 12345;
+            if ((seed >> 16) % 4 == 0) {
+                strcpy(w, lang.words[(seed >> 8) % nwords]);
+            } else {
+                int l = 1 + (seed >> 20) % 12;
+
+                w[0] = first[(seed >> 4) % (sizeof(first) - 1)];
+                for (int k = 1; k < l; k++) {
+                    seed = seed * 1103515245 + 12345;
+                    w[k] = rest[(seed >> 16) % (sizeof(rest) - 1)];
+                }
+                w[l] = '\0';
+            }
+            ident[i] = w;
+            len[i] = strlen(w);
+        }
+
+        t0 = Seconds();
+        for (long i = 0; i < n; i++)
+            sum_scan += LinearFind(lang.words, ident[i]);
+        t1 = Seconds();
+        for (long i = 0; i < n; i++)
+            sum_hash += KwFind(kt, ident[i], len[i]);
+        t2 = Seconds();
+
+        for (long i = 0; i < n; i++) {
+            int k = LinearFind(lang.words, ident[i]);
+
+            if (k != KwFind(kt, ident[i], len[i])) {
+                fprintf(stderr, "%s: %s: the two lookups differ on \"%s\"\n", argv[0], lang.name, ident[i]);
+                return 1;
+            }
+            found += (k >= 0);
+        }
+        if (sum_scan != sum_hash)     /* so the timed loops are not dropped */
+            return 1;
+        printf("%-8s %9.1f%% %10.1f %10.1f %7.1fx\n", lang.name, found * 100.0 / n,
+               (t1 - t0) * 1e9 / n, (t2 - t1) * 1e9 / n, (t1 - t0) / (t2 - t1));
+    }
+    return 0;
+}
@@ -0,0 +1,81 @@
+/*
+ * $Header: runstat.cpp $
+ *
+ * runstat [-o file] command [args...]
+ *
+ * Run a command, with its standard output sent to file if -o is given,
+ * and print its wall clock time in seconds and its peak resident set in
+ * kilobytes.  The benchmark harness uses this instead of time(1), whose
+ * options and output differ from system to system.  Exits with the
+ * command's status.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+static double Now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    const char *ofname = NULL;
+    struct rusage ru;
+    double start;
+    int status,
+            fd;
+    pid_t pid;
+
+    argv++;
+    argc--;
+    if (argc >= 2 && strcmp(argv[0], "-o") == 0) {
+        ofname = argv[1];
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc < 1) {
+        fprintf(stderr, "usage: runstat [-o file] command [args...]\n");
+        exit(2);
+    }
+
+    start = Now();
+    if ((pid = fork()) < 0) {
+        fprintf(stderr, "runstat: can't fork: %s\n", strerror(errno));
+        exit(2);
+    }
+    if (pid == 0) {
+        if (ofname != NULL) {
+            if ((fd = open(ofname, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
+                fprintf(stderr, "runstat: can't create '%s': %s\n", ofname, strerror(errno));
+                _exit(2);
+            }
+            dup2(fd, 1);
+            close(fd);
+        }
+        execvp(argv[0], argv);
+        fprintf(stderr, "runstat: can't run '%s': %s\n", argv[0], strerror(errno));
+        _exit(127);
+    }
+    while (wait4(pid, &status, 0, &ru) < 0) {
+        if (errno != EINTR) {
+            fprintf(stderr, "runstat: wait failed: %s\n", strerror(errno));
+            exit(2);
+        }
+    }
+    printf("%.4f %ld\n", Now() - start, ru.ru_maxrss);
+
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);
+    return 128 + WTERMSIG(status);
+}
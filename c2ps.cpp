@@ -144,40 +144,46 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/param.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <limits.h>
 #include <stdlib.h>     /* for getenv() */
 
 #endif
 
-#define LINEWIDTH       12
-#define NORMFSIZE       10
-#define SMALLFSIZE      8
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "layout.h"
+#include "metrics.h"
+#include "scan.h"
+
 #define BIGFSIZE        12
-#define MAXCHARSINLINE  10000
-#define BOTTOM          72
+#define MAXSHOWLEN      16000   /* longest string handed to one show */
+#define BLANK_PAGE_TEXT "This Page Intentionally Blank"
+#define INDEX_WIDTH     20      /* bytes per -index line */
 #define BOTLINE         BOTTOM - 2 * LINEWIDTH
-#define LMARG           60
 #define TRUE            1
 #define FALSE           0
 
-#define COMMENT_END_STAR_SLASH  1   /* C style comment */
+#define COMMENT_END_STAR_SLASH  1   /* C style comment, ends at comment_close */
 #define COMMENT_END_NEWLINE     2   /* Trellis or C++ comment */
 
 #ifndef MAXPATHLEN
-#define MAXPATHLEN      MAXCHARSINLINE
+#define MAXPATHLEN      1024
 #endif
 
-#define LANG_C      1
-#define LANG_TRELLIS    2
-#define LANG_CPP    3
-#define LANG_VERILOG    4
-#define LANG_VERA   5
-
-int language = LANG_CPP;        /* default is really based on suffix */
-int language_set = 0;
-
 char rcs_ident[] = "$Header: /home/sglaser/hw/pvt/sglaser/Source/RCS/c2ps.cpp,v 3.5 2013-09-24 18:00:36-07 sglaser Exp $";
 
-static const char *c_keywords[] = {
+static constexpr const char *c_keywords[] = {
         "_align",
         "asm",
         "auto",
@@ -222,7 +228,7 @@ static const char *c_keywords[] = {
         0
 };
 
-static const char *cpp_keywords[] = {
+static constexpr const char *cpp_keywords[] = {
         "_align",
         "asm",
         "auto",
@@ -275,7 +281,7 @@ static const char *cpp_keywords[] = {
         0
 };
 
-static const char *trellis_keywords[] = {
+static constexpr const char *trellis_keywords[] = {
         "and",
         "cand",
         "cor",
@@ -347,7 +353,7 @@ static const char *trellis_keywords[] = {
         0
 };
 
-static const char *verilog_keywords[] = {
+static constexpr const char *verilog_keywords[] = {
         "always", "and", "assign", "begin", "buf", "bufif0", "bufif1", "case",
         "casex", "casez", "cmos", "deassign", "default", "defparam", "disable",
         "edge", "else", "end", "endcase", "endmodule", "endfunction",
@@ -365,7 +371,7 @@ static const char *verilog_keywords[] = {
         "xor", 0
 };
 
-static const char *vera_keywords[] = {
+static constexpr const char *vera_keywords[] = {
         "all", "any", "begin", "bind", "bind_var", "bit", "break", "breakpoint",
         "case", "class", "continue", "coverage_block", "default", "depth", "else",
         "end", "enum", "event", "extern", "extends", "for", "fork", "funciton",
@@ -375,28 +381,17 @@ static const char *vera_keywords[] = {
         "task", "terminate", "this", "trans", "typedef", "var", "vector",
         "verilog_node", "verilog_task", "void", "while", "with", 0};
 
-static const char *no_keywords[] = {
+static constexpr const char *no_keywords[] = {
         0
 };
 
-/*
- * indexed by language and thus must track the defines for LANG_*
- */
-const char **keyword_array[] = {
-        no_keywords,
-        c_keywords,
-        trellis_keywords,
-        cpp_keywords,
-        verilog_keywords,
-        vera_keywords};
-
 typedef struct key_begin_end {
     const char *name;
     int offset;
 } key_begin_end_t;
 
-static key_begin_end_t no_func_start_end[] = {{0, 0}};
-static key_begin_end_t verilog_func_start_end[] = {
+static constexpr key_begin_end_t no_func_start_end[] = {{0, 0}};
+static constexpr key_begin_end_t verilog_func_start_end[] = {
         {"module",      1},
         {"endmodule",   -1},
         {"task",        1},
@@ -405,109 +400,795 @@ static key_begin_end_t verilog_func_start_end[] = {
         {"endfunction", -1},
         {0,             0}};
 
-key_begin_end_t *func_start_end_array[] = {no_func_start_end, /* none */
-                                           no_func_start_end, /* C */
-                                           no_func_start_end, /* trellis */
-                                           no_func_start_end, /* C++ */
-                                           verilog_func_start_end, /* Verilo   g */
-                                           no_func_start_end}; /* Vera */
+/*
+ * Keyword lookup.
+ *
+ * Each keyword list above is turned into a collision-free hash table at
+ * compile time: KwBuild() searches for a hash seed under which every
+ * keyword lands in its own slot.  A lookup is then a length and first
+ * character filter, one hash and at most one compare, so identifiers
+ * that can't be keywords are rejected without walking the list.  The
+ * func_depth offset of begin/end words (verilog module/endmodule etc.)
+ * is stored with the keyword so it comes back from the same lookup.
+ */
+#define KW_MAX_LEN  31          /* longest keyword the tables can hold */
 
-struct paper_sizes {
-    const char *name;
-    int x;
-    int y;
-} paper_sizes[] = {
-        {"-letter", 612, 792},
-        {"-a3",     594, 846},
-        {"-a4",     846, 1184},
-        {"-legal",  612, 1108},
-        {"-ledger", 792, 1224}};
-
-#define MAX_PAPER_SIZE 4    /* -ledger */
-
-const char *bottom_text = 0;
-
-char *argv0,
-        *header_string = 0,
-        ifname[120],
-        ofname[120],
-        ifname_full[MAXPATHLEN],
-        ibuffer[MAXCHARSINLINE],
-        obuffer[MAXCHARSINLINE],
-        tmpbuffer[MAXCHARSINLINE],
-        timbuf[50],
-        cword[120],
-        curfuncs[120],
-        funcname[120],
-        txtchar = ' ';
-
-int paper_size = 0,
-        fixed_font = FALSE,
-        rotate_text = FALSE,
-        txtmode,
-        process_mode,
-        moreonline,
-        comment_style,
-        lastwasbslash,
-        have_funcname,
-        top_of_page,
-        seen_directive,
-        seen_non_blank;
-
-int i,
-        j,
-        x,
-        urx,
-        ury,
-        top,
-        topline,
-        pageno = 0,
-        page_skip = 1,
-        pagecount = 0,
-        duplex = 0,
-        lineno = 1,
-        func_depth = 0,
-        paren_depth = 0,
-        square_bracket_depth = 0,
-        func_name_search = 0,
-        ypos,
-        rmarg,
-        wrap_col,
-        ibuffp,
-        obuffp,
-        cwordp;
-
-FILE *infile = NULL,
-        *outfile = NULL;
-
-int IsKeyword(),
-        IsItAFunc();
-
-void Usage(),
-        MakePaperSize(),
-        MakeProlog(),
-        PrintPage(),
-        MakeNewPage(),
-        PrintBlankPage(),
-        WriteBuffer(),
-        WriteFont(),
-        WriteLineNo(),
-        WhatToPutIn(),
-        PutWordInBuffer(),
-        WasKeyword(),
-        WasNotKeyword(),
-        WasAFunc(),
-        PutCharInWord(),
-        InComMode(),
-        StartComMode(),
-        StopTxtMode(),
-        InTxtMode(),
-        StartTxtMode(),
-        InFileMode(),
-        ParseFile(),
-        MakeTrailer(),
-        ResetForNewFile(),
-        ResetTimbuf();
+constexpr size_t KwCount(const char *const *words) {
+    size_t n = 0;
+    while (words[n] != 0)
+        n++;
+    return n;
+}
+
+constexpr unsigned KwLen(const char *s) {
+    unsigned n = 0;
+    while (s[n] != '\0')
+        n++;
+    return n;
+}
+
+constexpr unsigned KwMaxLen(const char *const *words) {
+    unsigned max = 0;
+    for (; *words != 0; words++)
+        if (KwLen(*words) > max)
+            max = KwLen(*words);
+    return max;
+}
+
+constexpr bool KwSame(const char *a, const char *b) {
+    while (*a != '\0' && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+/* slots are a power of two with at least 8 per keyword */
+constexpr size_t KwSlots(size_t n) {
+    size_t slots = 16;
+    while (slots < 8 * n)
+        slots *= 2;
+    return slots;
+}
+
+inline constexpr unsigned KwHash(const char *s, unsigned len, unsigned seed) {
+    unsigned h = seed ^ len;
+    for (unsigned k = 0; k < len; k++)
+        h = (h ^ (unsigned char) s[k]) * 0x01000193u;
+    return h ^ (h >> 13);
+}
+
+template<size_t N, size_t SLOTS>
+struct kw_hash_t {
+    unsigned seed;                  /* 0 if no perfect seed was found */
+    unsigned len_mask;              /* bit n set if a keyword has length n */
+    unsigned first_mask[8];         /* bit c set if a keyword starts with c */
+    unsigned char slot[SLOTS];      /* keyword index + 1, 0 if empty */
+    unsigned char len[N + 1];
+    signed char offset[N + 1];      /* func_depth change, see ParseFile() */
+};
+
+template<size_t N, size_t SLOTS>
+constexpr kw_hash_t<N, SLOTS> KwBuild(const char *const *words, const key_begin_end_t *begin_end) {
+    kw_hash_t<N, SLOTS> t{};
+
+    for (size_t k = 0; k < N; k++) {
+        unsigned len = KwLen(words[k]);
+        t.len[k] = (unsigned char) len;
+        t.len_mask |= 1u << len;
+        t.first_mask[(unsigned char) words[k][0] >> 5] |= 1u << ((unsigned char) words[k][0] & 31);
+        for (const key_begin_end_t *be = begin_end; be->name != 0; be++)
+            if (KwSame(be->name, words[k]))
+                t.offset[k] = (signed char) be->offset;
+    }
+    for (unsigned seed = 1; seed < 100000; seed++) {
+        bool ok = true;
+        for (size_t k = 0; k < SLOTS; k++)
+            t.slot[k] = 0;
+        for (size_t k = 0; k < N && ok; k++) {
+            unsigned h = KwHash(words[k], t.len[k], seed) & (SLOTS - 1);
+            if (t.slot[h] != 0)
+                ok = false;
+            else
+                t.slot[h] = (unsigned char) (k + 1);
+        }
+        if (ok) {
+            t.seed = seed;
+            return t;
+        }
+    }
+    return t;
+}
+
+#define KW_TABLE(name, words, begin_end) \
+    static constexpr auto name = \
+        KwBuild<KwCount(words), KwSlots(KwCount(words))>(words, begin_end); \
+    static_assert(name.seed != 0, "no perfect hash seed for " #words); \
+    static_assert(KwMaxLen(words) <= KW_MAX_LEN, "keyword too long in " #words)
+
+KW_TABLE(no_kw_hash, no_keywords, no_func_start_end);
+KW_TABLE(c_kw_hash, c_keywords, no_func_start_end);
+KW_TABLE(trellis_kw_hash, trellis_keywords, no_func_start_end);
+KW_TABLE(cpp_kw_hash, cpp_keywords, no_func_start_end);
+KW_TABLE(verilog_kw_hash, verilog_keywords, verilog_func_start_end);
+KW_TABLE(vera_kw_hash, vera_keywords, no_func_start_end);
+
+/*
+ * the run time view of a kw_hash_t, independent of its size
+ */
+typedef struct keyword_lookup {
+    const char *const *words;
+    const unsigned char *len;
+    const signed char *offset;
+    const unsigned char *slot;
+    const unsigned *first_mask;
+    unsigned mask;
+    unsigned seed;
+    unsigned len_mask;
+} keyword_lookup_t;
+
+#define KW_LOOKUP(words, table) \
+    {words, table.len, table.offset, table.slot, table.first_mask, \
+     sizeof(table.slot) - 1, table.seed, table.len_mask}
+
+/*
+ * indexed by language and thus must track the defines for LANG_*
+ */
+const keyword_lookup_t keyword_lookup[] = {
+        KW_LOOKUP(no_keywords, no_kw_hash),
+        KW_LOOKUP(c_keywords, c_kw_hash),
+        KW_LOOKUP(trellis_keywords, trellis_kw_hash),
+        KW_LOOKUP(cpp_keywords, cpp_kw_hash),
+        KW_LOOKUP(verilog_keywords, verilog_kw_hash),
+        KW_LOOKUP(vera_keywords, vera_kw_hash),
+        KW_LOOKUP(no_keywords, no_kw_hash)};      /* defined: see lang_def_t */
+
+/*
+ * keywords common enough that -compact defines a procedure (K0, K1, ...)
+ * in the prolog to show each one in the keyword font
+ */
+static constexpr const char *compact_keywords[] = {
+        "if", "else", "return", "int", "for", "while", "char", "struct",
+        "void", "const", "static", "unsigned", "case", "break", "sizeof", "long",
+        "switch", "default", "typedef", "enum", "extern", "continue", "do", "goto",
+        "double", "float", "union", "short", "signed", "register", "volatile", "class",
+        "public", "private", "protected", "virtual", "new", "delete", "this", "template",
+        "begin", "end", "module", "endmodule", "input", "output", "wire", "reg",
+        "assign", "always",
+        0};
+
+KW_TABLE(compact_kw_hash, compact_keywords, no_func_start_end);
+
+const keyword_lookup_t compact_lookup = KW_LOOKUP(compact_keywords, compact_kw_hash);
+
+/*
+ * The lexer.  Outside strings and comments, what LexLine() does with a
+ * character depends only on its class, and the class only on the
+ * language, so LexBuild() works out a class for every byte value at
+ * compile time and LexLine() is instantiated for each language: one
+ * table lookup per character instead of isalnum(), isspace() and a
+ * switch on the language.  Strings and comments are the same in every
+ * language and stay with InTxtMode() and InComMode().
+ */
+#define LX_PUNCT        0   /* anything else: ends a word and is shown */
+#define LX_BLANK        1   /* ' ', '\t' or '\v': the same, but not seen_non_blank */
+#define LX_WORD         2   /* part of an identifier or keyword */
+#define LX_END          3   /* '\n', '\r', '\f' or NUL: nothing after it is listed */
+#define LX_QUOTE        4   /* starts a string (or a C character constant) */
+#define LX_COMMENT      5   /* '/' may start a comment, trellis '!' does */
+#define LX_DIRECTIVE    6   /* C '#' */
+#define LX_BRACE_OPEN   7   /* C '{' and '}': func_depth */
+#define LX_BRACE_CLOSE  8
+#define LX_BRACKET_OPEN 9   /* verilog '[' and ']': square_bracket_depth */
+#define LX_BRACKET_CLOSE 10
+#define LX_PAREN_OPEN   11  /* verilog '(' and ')': paren_depth */
+#define LX_PAREN_CLOSE  12
+
+struct lex_table_t {
+    unsigned char cls[256];
+};
+
+/* isalnum() in the C locale, which is the only one c2ps runs in */
+constexpr bool LexIsAlnum(unsigned c) {
+    return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+}
+
+constexpr lex_table_t LexBuild(int language) {
+    lex_table_t t{};
+    bool c_like = (language == LANG_C || language == LANG_CPP);
+
+    for (unsigned c = 0; c < 256; c++) {
+        if (LexIsAlnum(c) || c == '_')
+            t.cls[c] = LX_WORD;
+        else if (c == ' ' || c == '\t' || c == '\v')
+            t.cls[c] = LX_BLANK;
+        else
+            t.cls[c] = LX_PUNCT;
+    }
+    t.cls['\n'] = t.cls['\r'] = t.cls['\f'] = t.cls['\0'] = LX_END;
+    t.cls['"'] = LX_QUOTE;
+    if (language == LANG_TRELLIS) {
+        t.cls['#'] = t.cls['?'] = LX_WORD;
+        t.cls['!'] = LX_COMMENT;
+    } else {
+        t.cls['$'] = LX_WORD;
+        t.cls['/'] = LX_COMMENT;
+    }
+    if (c_like) {
+        t.cls['\''] = LX_QUOTE;
+        t.cls['#'] = LX_DIRECTIVE;
+        t.cls['{'] = LX_BRACE_OPEN;
+        t.cls['}'] = LX_BRACE_CLOSE;
+    }
+    if (language == LANG_VERILOG) {
+        t.cls['['] = LX_BRACKET_OPEN;
+        t.cls[']'] = LX_BRACKET_CLOSE;
+        t.cls['('] = LX_PAREN_OPEN;
+        t.cls[')'] = LX_PAREN_CLOSE;
+    }
+    return t;
+}
+
+/*
+ * indexed by language and thus must track the defines for LANG_*
+ */
+static constexpr lex_table_t lex_tables[] = {
+        LexBuild(LANG_CPP),         /* no language: never used */
+        LexBuild(LANG_C),
+        LexBuild(LANG_TRELLIS),
+        LexBuild(LANG_CPP),
+        LexBuild(LANG_VERILOG),
+        LexBuild(LANG_VERA),
+        LexBuild(LANG_CPP)};        /* defined: see lang_image_t */
+
+/*
+ * index of kword (len characters long) in kt's word list, or -1
+ */
+static inline int KwFind(const keyword_lookup_t *kt, const char *kword, int len) {
+    unsigned char c0 = (unsigned char) kword[0];
+    unsigned k;
+
+    if (len > KW_MAX_LEN || (kt->len_mask & (1u << len)) == 0 ||
+        (kt->first_mask[c0 >> 5] & (1u << (c0 & 31))) == 0)
+        return -1;
+    k = kt->slot[KwHash(kword, len, kt->seed) & kt->mask];
+    if (k-- == 0 || kt->len[k] != len || memcmp(kt->words[k], kword, len) != 0)
+        return -1;
+    return k;
+}
+
+/*
+ * Languages read from definition files (-lang, see ParseLanguage() in
+ * layout.h).  LangCompile() turns a definition into a lang_image_t: the
+ * same lexer classes and perfect hash keyword table that the built in
+ * languages get at compile time, in one flat block.  Finding a hash seed
+ * is the only slow part for a long keyword list, so images are cached on
+ * disk, named by a hash of the definition, and a cached definition costs
+ * a read and a few checks.  LexLine<LANG_DEFINED>() lists a file in the
+ * language its lang_def points at.
+ */
+#define LANG_CACHE_MAGIC    "c2ps-lang 1"
+#define LANG_NAME_MAX       32
+
+struct lang_image_t {
+    char magic[16];
+    unsigned long long source[2];   /* HashBytes() of the definition file */
+    unsigned size,                  /* of the whole image */
+            nwords,
+            nslots,
+            seed,
+            len_mask,
+            first_mask[8];
+    char name[LANG_NAME_MAX],
+            line_comment[3],        /* "" if none */
+            block_open[3],
+            block_close[3],
+            directive,              /* 0 if none */
+            named_blocks;
+    lex_table_t lex;
+    /*
+     * followed by slot[nslots], len[nwords] and offset[nwords] as in
+     * kw_hash_t, then the keywords and the suffixes, NUL terminated and
+     * each list ended by an empty string
+     */
+};
+
+struct lang_def_t {
+    const lang_image_t *image;
+    std::vector<const char *> words,
+            suffixes;
+    keyword_lookup_t keywords;
+};
+
+const lang_def_t *LoadLanguage(const char *path, const char *cache_dir),
+        *FindLanguage(const char *name),
+        *LanguageDefForName(const char *fname);
+
+/*
+ * the length of delim if p starts with it, else 0 (and 0 if delim is "")
+ */
+static inline int Opens(const char *p, const char *delim) {
+    if (delim[0] == '\0' || p[0] != delim[0])
+        return 0;
+    if (delim[1] == '\0')
+        return 1;
+    return (p[1] == delim[1]) ? 2 : 0;
+}
+
+#define LOOKAHEAD_LINES 21      /* lines IsItAFunc() may look past the current one */
+#define MATCH_LINES 32          /* lines of ParenMatches kept, > LOOKAHEAD_LINES */
+#define MATCH_MIN_COLS 64       /* shortest paren pair worth a ParenMatches entry */
+
+char *argv0;
+
+void Usage();
+
+/*
+ * PostScript output.  Everything c2ps writes goes through a PsWriter, which
+ * collects it in a large buffer and hands it to the kernel in big write()s,
+ * with integers formatted and literal strings copied directly rather than
+ * through printf.  A PsWriter that isn't attached to a file descriptor just
+ * keeps growing its buffer; -j renders each input file into one of those.
+ */
+#define WRITE_BLOCK     (1 << 20)   /* output buffer and write size */
+
+class PsWriter {
+public:
+    ~PsWriter() { free(buf); }
+
+    void Open(int fd_p, const char *name_p),
+            Flush(),
+            Close(),
+            Printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+    bool IsOpen() const { return fd >= 0 || buf != NULL; }
+
+    /* bytes written so far */
+    size_t Tell() const { return flushed + len; }
+
+    /* what a memory PsWriter holds; Rewind() empties it */
+    const char *Data() const { return buf; }
+
+    void Rewind() { len = flushed = 0; }
+
+    /* trade places with o, to divert output for a while */
+    void Swap(PsWriter &o) {
+        std::swap(fd, o.fd);
+        std::swap(name, o.name);
+        std::swap(buf, o.buf);
+        std::swap(len, o.len);
+        std::swap(size, o.size);
+        std::swap(flushed, o.flushed);
+    }
+
+    /* take the contents of a memory PsWriter, leaving it closed */
+    char *Release(size_t *len_p) {
+        char *b = buf;
+
+        *len_p = len;
+        buf = NULL;
+        len = size = 0;
+        return b;
+    }
+
+    void Write(const char *s, size_t n) {
+        if (size - len < n)
+            MakeRoom(n);
+        if (size - len < n) {
+            WriteOut(s, n);     /* bigger than the buffer, don't copy it */
+            return;
+        }
+        memcpy(buf + len, s, n);
+        len += n;
+    }
+
+    void Str(const char *s) { Write(s, strlen(s)); }
+
+    template<size_t N>
+    void Lit(const char (&s)[N]) { Write(s, N - 1); }
+
+    void Char(char c) {
+        if (len == size)
+            MakeRoom(1);
+        buf[len++] = c;
+    }
+
+    void Int(int v) {
+        char digits[12],
+                *p = digits + sizeof(digits);
+        unsigned u = (v < 0) ? -(unsigned) v : v;
+
+        do {
+            *--p = '0' + u % 10;
+            u /= 10;
+        } while (u != 0);
+        if (v < 0)
+            *--p = '-';
+        Write(p, digits + sizeof(digits) - p);
+    }
+
+    /* v / 1000, with no more decimals than it takes */
+    void Milli(int v) {
+        char frac[4];
+        int n;
+
+        if (v < 0) {
+            Char('-');
+            v = -v;
+        }
+        Int(v / 1000);
+        if ((v %= 1000) != 0) {
+            frac[0] = '.';
+            frac[1] = '0' + v / 100;
+            frac[2] = '0' + v / 10 % 10;
+            frac[3] = '0' + v % 10;
+            for (n = 4; frac[n - 1] == '0'; n--)
+                ;
+            Write(frac, n);
+        }
+    }
+
+private:
+    int fd = -1;
+    const char *name = NULL;        /* for error messages */
+    char *buf = NULL;
+    size_t len = 0,
+            size = 0,
+            flushed = 0;            /* bytes already handed to write() */
+
+    void MakeRoom(size_t n),
+            WriteOut(const char *s, size_t n);
+};
+
+/*
+ * Compressed page bodies.  A page is either LZW encoded the way the LZWDecode
+ * filter expects (-compress, LanguageLevel 2; EarlyChange 1, so codes grow
+ * from 9 to 12 bits with the code after table entries 511, 1023 and 2047)
+ * or deflated into a zlib stream for FlateDecode (-flate, LanguageLevel 3),
+ * then ASCII85 encoded.  The prolog's Z procedure runs the page through
+ *     currentfile /ASCII85Decode filter /LZWDecode (or /FlateDecode) filter
+ * and the data follows it up to ~>.  Each page is compressed on its own
+ * so the %%Page structure and page independence are kept.
+ */
+#define COMPRESS_LZW    1
+#define COMPRESS_FLATE  2
+
+#define LZW_CLEAR       256
+#define LZW_EOD         257
+#define LZW_FIRST       258         /* first code assigned to a string */
+#define LZW_LAST        4093        /* clear the table after assigning this */
+#define LZW_HASH        8192        /* power of two > 2 * 4096 */
+
+#define FLATE_WINDOW    32768
+#define FLATE_HASH      32768
+#define FLATE_CHAIN     32          /* match candidates tried per position */
+#define FLATE_LAZY      32          /* look one byte ahead for matches shorter than this */
+#define FLATE_MATCH     0x80000000u /* tokens[] entry is a match */
+
+#define A85_LINE        72          /* ASCII85 characters per line */
+
+class PageEncoder {
+public:
+    void Encode(PsWriter &out, int method, const char *s, size_t n);
+
+private:
+    PsWriter *out;
+    unsigned long long bitbuf;      /* bits not yet packed into a byte */
+    unsigned nbits,
+            group,                  /* ASCII85 group being collected */
+            ngroup,
+            col;
+
+    /* LZW */
+    unsigned key[LZW_HASH];         /* (prefix << 8 | byte) + 1, 0 if free */
+    unsigned short code[LZW_HASH];
+    unsigned next_code;
+
+    /* Flate */
+    long head[FLATE_HASH],          /* last position with each hash, -1 */
+            prev[FLATE_WINDOW],     /* position before it with the same hash */
+            origin = 0;             /* head and prev hold origin + position */
+    bool head_ready = false;
+    std::vector<unsigned> tokens;   /* literal, or FLATE_MATCH | length << 16 | distance */
+
+    void Lzw(const char *s, size_t n),
+            ClearTable(),
+            PutCode(unsigned c),
+            Flate(const char *s, size_t n),
+            FlateBlock(),
+            PutBits(unsigned v, unsigned n),
+            PutByte(unsigned char c),
+            PutA85(const char *s, int n);
+
+    unsigned FindMatch(const char *s, size_t n, size_t i, unsigned *dist);
+};
+
+/*
+ * Input lines.  A regular file is mapped and its lines are handed out in
+ * place, with no copying and no limit on their length.  Anything else
+ * (pipes, terminals, stdin) is read in large blocks into a buffer.  Each
+ * line ends with its '\n' or, for a last line without one, with a '\0':
+ * the mapping is placed at the start of a zeroed one a byte longer, so
+ * there is always a '\0' after the file without copying any of it.
+ * Up to LOOKAHEAD_LINES lines past the current one can be peeked at
+ * without disturbing it.
+ *
+ * Every pointer handed out stays valid until the next NextLine(); buffers
+ * that had to be grown for a PeekLine() are kept until then.
+ */
+#define READ_BLOCK      (1 << 20)   /* initial buffer and read size */
+#define DROP_BEHIND     (16 << 20)  /* release mapped input in chunks this big */
+
+class LineReader {
+public:
+    ~LineReader() { Close(); }
+
+    void Open(int fd),
+            Close();
+
+    const char *NextLine(),
+            *PeekLine(int n);
+
+    int Error() const { return error; }
+
+    /* length of the current line, with its '\n' if it has one */
+    size_t LineLength() const { return ends[0] - starts[0]; }
+
+private:
+    int fd = -1,
+            error = 0,              /* errno of a failed read */
+            nlines = 0;             /* current line plus lines peeked at */
+    bool mapped = false,
+            at_eof = false;
+    char *data = NULL;              /* the mapping or the buffer */
+    size_t len = 0,                 /* bytes in data */
+            size = 0,               /* allocated size of the buffer, or of the mapping */
+            dropped = 0;            /* mapped bytes given back already */
+    size_t starts[LOOKAHEAD_LINES + 1],  /* current and peeked lines */
+            ends[LOOKAHEAD_LINES + 1];
+    std::vector<char *> retired;    /* outgrown buffers still pointed into */
+
+    bool FindLine(size_t start, size_t *end);
+    void Fill();
+};
+
+/*
+ * The command line options in effect for an input file, plus the file
+ * itself.  main() fills these in as it walks the arguments.
+ */
+struct RenderOptions {
+    int language = LANG_CPP,        /* default is really based on suffix */
+            process_mode = 0,
+            paper_size = 0,
+            fixed_font = FALSE,
+            rotate_text = FALSE,
+            page_skip = 1,
+            duplex = 0,
+            compact = FALSE,        /* smaller PostScript, see MakeProlog() */
+            compress = 0;           /* COMPRESS_LZW or _FLATE, see PageEncoder */
+    time_t date_epoch = -1;         /* SOURCE_DATE_EPOCH, or -1 */
+    const lang_def_t *lang_def = NULL;  /* the language, if LANG_DEFINED */
+    const char *bottom_text = 0;
+    char *header_string = 0;
+
+    char ifname[120],
+            ofname[120],
+            ifname_full[MAXPATHLEN];
+};
+
+/*
+ * The rendered pages of one input file, with the %%Page comments left
+ * out.  pages holds the offset in buf at which each page's comment
+ * belongs; WriteFragment() puts them back, numbered for the document.
+ */
+struct Fragment {
+    char *buf = NULL;
+    size_t len = 0;
+    std::vector<long> pages;
+    int error = 0;                  /* errno if the file couldn't be opened */
+    bool done = false;
+};
+
+/*
+ * An on-disk cache of Fragments (-cache dir), so reprinting a tree only
+ * renders the files that changed.  An entry is named by a hash of its key,
+ * which holds a hash of the file's contents and everything else that goes
+ * into its pages: the options, the name and date in the page headers and
+ * the c2ps binary itself.  The key is stored in the entry as well and
+ * checked on a hit.  Entries are written to a temporary file and renamed,
+ * so c2ps processes can share a cache; a hit refreshes the entry's mtime
+ * and Trim() removes the least recently used entries past the size limit.
+ */
+#define CACHE_SIZE      (256LL << 20)   /* default -cache-size, bytes */
+#define CACHE_KEY_MAX   (3 * MAXPATHLEN)
+
+class FragmentCache {
+public:
+    void Open(const char *dir_p, long long max_bytes_p);
+
+    bool Lookup(const char *key, Fragment *frag);
+
+    void Store(const char *key, const Fragment &frag),
+            Trim(),
+            Report();
+
+private:
+    const char *dir;
+    long long max_bytes;
+    std::atomic<int> hits{0},
+            misses{0},
+            stored{0},
+            evicted{0};
+    std::atomic<long long> bytes_read{0},
+            bytes_written{0};
+    std::atomic<unsigned> tmp_serial{0};
+
+    char build[64];                 /* identifies the c2ps binary */
+
+    void EntryName(const char *key, char *name, size_t size);
+
+    friend class Renderer;
+};
+
+extern FragmentCache *fragment_cache;
+
+/*
+ * What IsItAFunc() learned about one line.  For each paren on it that a
+ * scan walked past, this holds where its match is (line and column): the
+ * ')' closing a '(', or the '(' that balances a ')' the scan met while
+ * outside any parens.  A column of -1 instead gives the last line the
+ * paren was known to be unmatched on, INT_MAX if the scan can never get
+ * past it.  Every identifier in front of a nest of parens scans the same
+ * text, so later scans jump over it instead of walking it again.
+ */
+struct ParenMatches {
+    int line = 0;                   /* line number these are for */
+    std::unordered_map<int, std::pair<int, int>> close;    /* by column of the paren */
+};
+
+/*
+ * A Renderer holds all the parser and layout state for turning input files
+ * into one PostScript document.  Renderers share nothing but the read-only
+ * tables above, so several may be working at the same time.
+ *
+ * main() fills in the options and the input/output files, then calls
+ * MakePaperSize() and MakeProlog() once, ParseFile() for each input file
+ * and MakeTrailer() at the end.  With -j, input files are instead handed
+ * to worker Renderers that share the document's layout (CopyLayout()),
+ * render each file into a Fragment (RenderFragment()), and the document's
+ * Renderer splices the fragments in with WriteFragment().
+ */
+class Renderer : public RenderOptions {
+public:
+    FILE *infile = NULL;
+    PsWriter out;
+
+    void MakePaperSize(),
+            MakeProlog(),
+            ResetTimbuf(),
+            ParseFile(),
+            MakeTrailer(),
+            CopyLayout(const Renderer &doc),
+            RenderFragment(Fragment *frag),
+            CacheKey(char *key, size_t size),
+            WriteFragment(const Fragment &frag),
+            WriteIndex(),
+            OpenDocument(),
+            ShardBreak();
+    int DryRun();
+
+    int pagecount = 0,
+            shard_pages = 0,                /* -shard-pages, 0 for one document */
+            shard = 0;                      /* the shard being written, from 1 */
+    const char *index_name = NULL;          /* -index file */
+    std::vector<long long> page_offsets;    /* of each %%Page, for -index */
+    char doc_name[sizeof(ofname) + 16];     /* ofname, or the shard of it */
+
+private:
+    const char *ibuffer,            /* the current line */
+            *cword,                 /* the last word seen on it */
+            *comment_close;         /* what ends a COMMENT_END_STAR_SLASH comment */
+    char obuffer[MAXSHOWLEN + 9],
+            timbuf[50],
+            funcname[120],
+            txtchar = ' ';
+
+    int txtmode,
+            moreonline,
+            comment_style,
+            lastwasbslash,
+            have_funcname,
+            top_of_page,
+            seen_directive,
+            seen_non_blank;
+
+    int x,
+            urx,
+            ury,
+            top,
+            topline,
+            pageno = 0,
+            lineno = 1,
+            func_depth = 0,
+            paren_depth = 0,
+            square_bracket_depth = 0,
+            func_name_search = 0,
+            ypos,
+            rmarg,
+            wrap_col,
+            ibuffp,
+            obuffp,
+            cwordp,                 /* length of the word being gathered */
+            cwordlen,               /* length of cword */
+            cur_font = 0,           /* font selected on this page, 0 if none */
+            want_font = 0,          /* font for the next show (-compact) */
+            line_y = -1;            /* last line moved to on this page (-compact) */
+
+    time_t todays_date;
+    const char *prolog_bottom = 0;  /* the bottom_text D draws, see MakeProlog() */
+
+    std::vector<long> *page_marks = NULL;   /* where %%Page goes in a Fragment */
+    std::vector<int> gutter;        /* line number, y pairs for WriteGutter() */
+
+    LineReader input;
+
+    ParenMatches paren_matches[MATCH_LINES];    /* by line number % MATCH_LINES */
+    std::vector<std::pair<int, int>> open_parens;   /* unmatched parens of the current scan */
+    std::string cword_split;        /* cword, once a literal inside it split it */
+    int scan_rescanned;             /* it went past end of file in a comment */
+
+    PsWriter page_body;             /* the page being drawn, for -compress */
+    PageEncoder encoder;
+
+    template<int LANG>
+    int IsKeyword(const char *kword, int len, int *offset);
+
+    template<int LANG>
+    void LexLine();
+
+    template<int LANG>
+    void EndWord();
+
+    int IsItAFunc(const char *buf, int comment, int tmp, int par, int seen, int lines_seen),
+            SkipToMatch(const char **buf, int *tmp, int *lines_seen);
+
+    std::unordered_map<int, std::pair<int, int>> &ParenMatchesOn(int line);
+
+    void PrintPage(),
+            PageComment(),
+            EndPage(),
+            MakeNewPage(),
+            PrintBlankPage(),
+            WriteBuffer(),
+            MoveTo(int x, int y),
+            MoveToLine(),
+            WriteFont(int fn),
+            SelectFont(),
+            WriteLineNo(int ln),
+            WriteGutter(),
+            WriteDecorations(),
+            RightX(const char *str, int rx, int fn, int size),
+            WhatToPutIn(char c),
+            CopyToBuffer(const char *p, size_t n),
+            PutRun(char a, char b),
+            PutWordInBuffer(),
+            WasKeyword(),
+            WasNotKeyword(),
+            WasAFunc(),
+            MatchParen(int line, int col),
+            OpenParensUntil(int line),
+            InComMode(),
+            StartComMode(int style, int is_two_char),
+            StopTxtMode(),
+            InTxtMode(),
+            StartTxtMode(),
+            InFileLine(),
+            WrapLine();
+
+    const char *PutText(const char *p, const char *end, char a, char b);
+};
+
+void RenderParallel(Renderer *doc, std::vector<RenderOptions> &jobs, int nthreads);
 
 void print_args(const char *tag, int argc, char **argv) {
     int i;
@@ -572,14 +1253,73 @@ prepend_args(int *argc_ptr, char ***argv_ptr) {
 }
 
 
+/*
+ * render r's input file into r's document, through a Fragment that may
+ * come from the cache with -cache
+ */
+static void RenderFile(Renderer *r, const char *cache_dir, long long cache_size) {
+    static Renderer *fr = NULL;     /* renders -cache fragments */
+
+    if (cache_dir != NULL) {
+        Fragment frag;
+
+        if (fragment_cache == NULL) {
+            fragment_cache = new FragmentCache;
+            fragment_cache->Open(cache_dir, cache_size);
+            fr = new Renderer;
+        }
+        static_cast<RenderOptions &>(*fr) = *r;
+        fr->CopyLayout(*r);
+        fr->RenderFragment(&frag);
+        if (frag.error != 0) {
+            fprintf(stderr, "%s : can't open '%s' %s\n", argv0, r->ifname, strerror(frag.error));
+            exit(1);
+        }
+        r->WriteFragment(frag);
+        free(frag.buf);
+        return;
+    }
+
+    if (r->ifname[0] == '-') {
+        r->infile = stdin;
+    } else if ((r->infile = fopen(r->ifname, "r")) == NULL) {
+#ifdef VMS
+        fprintf(stderr, "%s : can't open '%s'\n", argv0, r->ifname);
+#else
+        fprintf(stderr, "%s : can't open '%s' %s\n", argv0, r->ifname, strerror(errno));
+#endif
+        exit(1);
+    }
+
+    r->ResetTimbuf();
+    r->ParseFile();
+    fclose(r->infile);
+    r->infile = NULL;
+}
+
+
 /*
  * main entry point
  */
 int
 main(int argc, char **argv) {
-    char name[80];
     char *dotpos;
-    int found_file_name;
+    int i,
+            j,
+            found_file_name,
+            language_set = 0,
+            nthreads = 1,
+            dry_run = FALSE,
+            dry_files = 0,
+            shards = 0,             /* -shards */
+            shard_pages = 0,        /* -shard-pages, or worked out for -shards */
+            counting = FALSE,       /* files wait in jobs until -shards has counted their pages */
+            lang_loaded = FALSE;    /* a -lang has been read, with cache_dir as it was */
+    Renderer *r = new Renderer;
+    std::vector<RenderOptions> jobs;     /* files left for RenderParallel(), or to count */
+    const char *cache_dir = NULL,
+            *epoch;
+    long long cache_size = CACHE_SIZE;
 
     //    extern char *strrchr();
 
@@ -593,7 +1333,9 @@ main(int argc, char **argv) {
         Usage();
 
     found_file_name = FALSE;
-    ofname[0] = '\0';
+    r->ofname[0] = '\0';
+    if ((epoch = getenv("SOURCE_DATE_EPOCH")) != NULL && *epoch != '\0')
+        r->date_epoch = (time_t) strtoll(epoch, NULL, 10);
 
     for (i = 1; i < argc; i++) {
         if ((argv[i][0] == '-') && (argv[i][1] != '\0')) {
@@ -603,13 +1345,71 @@ main(int argc, char **argv) {
                  */
                 for (j = 0; j <= MAX_PAPER_SIZE; j++) {
                     if (strcmp(argv[i], paper_sizes[j].name) == 0) {
-                        paper_size = j;
+                        r->paper_size = j;
                         goto next_option;
                     }
                 }
                 if ((strcmp(argv[i], "-o") == 0) && ((i + 1) < argc)) {
                     i++;
-                    strcpy(ofname, argv[i]);
+                    strcpy(r->ofname, argv[i]);
+                    goto next_option;
+                }
+                if ((strcmp(argv[i], "-index") == 0) && ((i + 1) < argc)) {
+                    i++;
+                    r->index_name = argv[i];
+                    goto next_option;
+                }
+                if ((strcmp(argv[i], "-shard-pages") == 0) && ((i + 1) < argc)) {
+                    i++;
+                    if ((shard_pages = atoi(argv[i])) < 1)
+                        Usage();
+                    r->shard_pages = shard_pages;
+                    goto next_option;
+                }
+                if ((strcmp(argv[i], "-shards") == 0) && ((i + 1) < argc)) {
+                    i++;
+                    if ((shards = atoi(argv[i])) < 1)
+                        Usage();
+                    goto next_option;
+                }
+                if (strcmp(argv[i], "-compact") == 0) {
+                    r->compact = TRUE;
+                    goto next_option;
+                }
+                if (strcmp(argv[i], "-dry-run") == 0) {
+                    dry_run = TRUE;
+                    goto next_option;
+                }
+                if (strcmp(argv[i], "-compress") == 0) {
+                    r->compress = COMPRESS_LZW;
+                    goto next_option;
+                }
+                if (strcmp(argv[i], "-flate") == 0) {
+                    r->compress = COMPRESS_FLATE;
+                    goto next_option;
+                }
+                if ((strcmp(argv[i], "-cache") == 0) && ((i + 1) < argc)) {
+                    i++;
+                    if (lang_loaded) {
+                        /* its definitions went to the default cache already */
+                        fprintf(stderr, "%s: -cache must come before -lang\n", argv0);
+                        exit(1);
+                    }
+                    cache_dir = argv[i];
+                    goto next_option;
+                }
+                if ((strcmp(argv[i], "-cache-size") == 0) && ((i + 1) < argc)) {
+                    i++;
+                    cache_size = atoll(argv[i]) << 20;
+                    if (cache_size <= 0)
+                        Usage();
+                    goto next_option;
+                }
+                if ((strcmp(argv[i], "-j") == 0) && ((i + 1) < argc)) {
+                    i++;
+                    nthreads = atoi(argv[i]);
+                    if (nthreads < 1)
+                        Usage();
                     goto next_option;
                 }
             }
@@ -619,245 +1419,262 @@ main(int argc, char **argv) {
              */
             if ((strcmp(argv[i], "-hdr") == 0) && ((i + 1) < argc)) {
                 i++;
-                header_string = argv[i];
+                r->header_string = argv[i];
             } else if (strcmp(argv[i], "-text") == 0) {
-                process_mode = 1;
+                r->process_mode = 1;
                 goto next_option;
             } else if (strcmp(argv[i], "-c") == 0) {
-                process_mode = 0;
-                language = LANG_C;
+                r->process_mode = 0;
+                r->language = LANG_C;
                 language_set = 1;
                 goto next_option;
             } else if (strcmp(argv[i], "-trellis") == 0) {
-                process_mode = 0;
-                language = LANG_TRELLIS;
+                r->process_mode = 0;
+                r->language = LANG_TRELLIS;
                 language_set = 1;
                 goto next_option;
             } else if (strcmp(argv[i], "-c++") == 0) {
-                process_mode = 0;
-                language = LANG_CPP;
+                r->process_mode = 0;
+                r->language = LANG_CPP;
                 language_set = 1;
                 goto next_option;
             } else if (strcmp(argv[i], "-verilog") == 0) {
-                process_mode = 0;
-                language = LANG_VERILOG;
+                r->process_mode = 0;
+                r->language = LANG_VERILOG;
                 language_set = 1;
                 goto next_option;
             } else if (strcmp(argv[i], "-vera") == 0) {
-                process_mode = 0;
-                language = LANG_VERA;
+                r->process_mode = 0;
+                r->language = LANG_VERA;
                 language_set = 1;
                 goto next_option;
             } else if (strcmp(argv[i], "-ext") == 0) {
-                process_mode = 0;
-                language = LANG_CPP;
+                r->process_mode = 0;
+                r->language = LANG_CPP;
                 language_set = 0;
                 goto next_option;
+            } else if ((strcmp(argv[i], "-lang") == 0) && ((i + 1) < argc)) {
+                i++;
+                LoadLanguage(argv[i], cache_dir);
+                lang_loaded = TRUE;
+                goto next_option;
+            } else if ((strcmp(argv[i], "-language") == 0) && ((i + 1) < argc)) {
+                i++;
+                if ((r->lang_def = FindLanguage(argv[i])) == NULL) {
+                    fprintf(stderr, "%s: no -lang definition of '%s'\n", argv0, argv[i]);
+                    exit(1);
+                }
+                r->process_mode = 0;
+                r->language = LANG_DEFINED;
+                language_set = 1;
+                goto next_option;
             } else if (strcmp(argv[i], "-internal") == 0) {
-                bottom_text = "Nvidia Internal Use Only";
+                r->bottom_text = "Nvidia Internal Use Only";
                 goto next_option;
             } else if (strcmp(argv[i], "-confidential") == 0) {
-                bottom_text = "Nvidia Confidential";
+                r->bottom_text = "Nvidia Confidential";
                 goto next_option;
             } else if (strcmp(argv[i], "-restricted") == 0) {
-                bottom_text = "Nvidia Restricted Distribution";
+                r->bottom_text = "Nvidia Restricted Distribution";
                 goto next_option;
             } else if ((strcmp(argv[i], "-bottom") == 0) && i + 1 < argc) {
                 i++;
-                bottom_text = argv[i];
+                r->bottom_text = argv[i];
                 goto next_option;
             } else if (strcmp(argv[i], "-proportional") == 0) {
-                fixed_font = FALSE;
+                r->fixed_font = FALSE;
                 goto next_option;
             } else if (strcmp(argv[i], "-fixed") == 0) {
-                fixed_font = TRUE;
+                r->fixed_font = TRUE;
                 goto next_option;
             } else if (strcmp(argv[i], "-rotate") == 0) {
-                rotate_text = TRUE;
+                r->rotate_text = TRUE;
                 goto next_option;
             } else if (strcmp(argv[i], "-1") == 0) {
-                page_skip = 1;
+                r->page_skip = 1;
                 goto next_option;
             } else if (strcmp(argv[i], "-2") == 0) {
-                page_skip = 2;
+                r->page_skip = 2;
                 goto next_option;
             } else if (strcmp(argv[i], "-4") == 0) {
-                page_skip = 4;
+                r->page_skip = 4;
                 goto next_option;
             } else if (strcmp(argv[i], "-8") == 0) {
-                page_skip = 8;
+                r->page_skip = 8;
                 goto next_option;
             } else if (strcmp(argv[i], "-duplex") == 0) {
-                duplex = 1;
+                r->duplex = 1;
             } else {
                 Usage();
             }
 
         } else {
 
-            if (ofname[0] == '\0') {
-                strcpy(ofname, argv[i]);
-                dotpos = strrchr(ofname, '.');
+            if (r->ofname[0] == '\0') {
+                strcpy(r->ofname, argv[i]);
+                dotpos = strrchr(r->ofname, '.');
                 if (dotpos != NULL)
                     *dotpos = '\0';
-                strcat(ofname, ".ps");
+                strcat(r->ofname, ".ps");
             }
 
-            if (outfile == NULL) {
-                if ((strcmp(ofname, "-") == 0) ||
-                    (strcmp(ofname, "-.ps") == 0)) {
-                    outfile = stdout;
-                } else {
-                    if ((outfile = fopen(ofname, "w+")) == NULL) {
-#ifdef VMS
-                        fprintf(stderr, "%s: can't open '%s'\n", argv0, ofname);
-#else
-                        fprintf(stderr, "%s: can't open '%s' %s\n", argv0, ofname, strerror(errno));
-#endif
-                        exit(1);
-                    }
-                }
-                MakePaperSize();
-                MakeProlog();
+            if (found_file_name == FALSE)
+                counting = shards > 0 && shard_pages == 0 && !dry_run;
+
+            if (dry_run) {
+                /* lay the pages out, but write nothing */
+                if (dry_files++ == 0)
+                    r->MakePaperSize();
+            } else if (!r->out.IsOpen() && !counting) {
+                r->OpenDocument();
+                r->MakePaperSize();
+                r->MakeProlog();
             }
 
             found_file_name = TRUE;
-            strcpy(ifname, argv[i]);
+            strcpy(r->ifname, argv[i]);
 
 #ifdef VMS
-            strcpy(ifname_full, ifname);
+            strcpy(r->ifname_full, r->ifname);
 #else
-            if (ifname[0] == '/') {
-                strcpy(ifname_full, ifname);
-            } else if (ifname[0] == '-') {
-                strcpy(ifname_full, "standard input");
+            if (r->ifname[0] == '/') {
+                strcpy(r->ifname_full, r->ifname);
+            } else if (r->ifname[0] == '-') {
+                strcpy(r->ifname_full, "standard input");
             } else {
-                getcwd(ifname_full, sizeof(ifname_full) - 2 - strlen(ifname));
-                strcat(ifname_full, "/");
-                strcat(ifname_full, ifname);
+                getcwd(r->ifname_full, sizeof(r->ifname_full) - 2 - strlen(r->ifname));
+                strcat(r->ifname_full, "/");
+                strcat(r->ifname_full, r->ifname);
             }
 #endif
-            if (ifname[0] == '-') {
-                infile = stdin;
-            } else if ((infile = fopen(ifname, "r")) == NULL) {
-#ifdef VMS
-                fprintf(stderr, "%s : can't open '%s'\n", argv0, ifname);
-#else
-                fprintf(stderr, "%s : can't open '%s' %s\n", argv0, ifname, strerror(errno));
-#endif
-                exit(1);
-            }
-
             if (language_set == 0) {
-                dotpos = strrchr(ifname, '.');
-                if (dotpos != NULL) {
-                    if ((strcmp(dotpos, ".c") == 0) ||
-                        (strcmp(dotpos, ".h") == 0)) {
-                        process_mode = 0;
-                        language = LANG_C;
-                    } else if ((strcmp(dotpos, ".cxx") == 0) ||
-                               (strcmp(dotpos, ".hxx") == 0) ||
-                               (strcmp(dotpos, ".icc") == 0) ||
-                               (strcmp(dotpos, ".cpp") == 0) ||
-                               (strcmp(dotpos, ".hpp") == 0) ||
-                               (strcmp(dotpos, ".C") == 0) ||
-                               (strcmp(dotpos, ".H") == 0) ||
-                               (strcmp(dotpos, ".cc") == 0) ||
-                               (strcmp(dotpos, ".hh") == 0) ||
-                               (strcmp(dotpos, ".CC") == 0) ||
-                               (strcmp(dotpos, ".HH") == 0)) {
-                        process_mode = 0;
-                        language = LANG_CPP;
-                    } else if ((strcmp(dotpos, ".verilog") == 0) ||
-                               (strcmp(dotpos, ".v") == 0) ||
-                               (strcmp(dotpos, ".vh") == 0) ||
-                               (strcmp(dotpos, ".vs") == 0)) {
-                        process_mode = 0;
-                        language = LANG_VERILOG;
-                    } else if ((strcmp(dotpos, ".vr") == 0) ||
-                               (strcmp(dotpos, ".vrh") == 0)) {
-                        process_mode = 0;
-                        language = LANG_VERA;
-                    } else if ((strcmp(dotpos, ".trellis") == 0)) {
-                        process_mode = 0;
-                        language = LANG_TRELLIS;
-                    } else {
-                        /* -text */
-                        process_mode = 1;
-                    }
+                if ((r->lang_def = LanguageDefForName(r->ifname)) != NULL) {
+                    r->process_mode = 0;
+                    r->language = LANG_DEFINED;
+                } else if ((j = LanguageForName(r->ifname)) != 0) {
+                    r->process_mode = 0;
+                    r->language = j;
                 } else {
                     /* -text */
-                    process_mode = 1;
+                    r->process_mode = 1;
                 }
             }
-            ResetTimbuf();
-            ParseFile();
-            fclose(infile);
-            infile = NULL;
 
+            if (dry_run) {
+                j = r->DryRun();
+                printf("%8d %s\n", j, r->ifname);
+                goto next_option;
+            }
+
+            if (counting && r->ifname[0] == '-') {
+                fprintf(stderr, "%s: can't count the pages of standard input for -shards\n", argv0);
+                exit(1);
+            }
+            if (counting || nthreads > 1) {
+                jobs.push_back(*r);
+                goto next_option;
+            }
+
+            RenderFile(r, cache_dir, cache_size);
         }
 
         next_option:
         if (i >= argc)
             Usage();
     }
-    if (outfile != NULL)
-        MakeTrailer();
+    if (counting) {
+        /*
+         * lay the files out to count their pages, for shards of equal
+         * size, each a whole number of page_skip pages
+         */
+        Renderer *c = new Renderer;
+
+        for (size_t k = 0; k < jobs.size(); k++) {
+            static_cast<RenderOptions &>(*c) = jobs[k];
+            if (k == 0)
+                c->MakePaperSize();
+            c->DryRun();
+        }
+        shard_pages = (c->pagecount + shards - 1) / shards;
+        shard_pages = std::max((shard_pages + c->page_skip - 1) / c->page_skip * c->page_skip, 1);
+        delete c;
+
+        /* start the document with the options the first file had */
+        static_cast<RenderOptions &>(*r) = jobs[0];
+        r->shard_pages = shard_pages;
+        r->OpenDocument();
+        r->MakePaperSize();
+        r->MakeProlog();
+        if (nthreads == 1) {
+            for (const RenderOptions &job : jobs) {
+                static_cast<RenderOptions &>(*r) = job;
+                RenderFile(r, cache_dir, cache_size);
+            }
+            jobs.clear();
+        }
+    }
+    if (!jobs.empty()) {
+        if (cache_dir != NULL) {
+            fragment_cache = new FragmentCache;
+            fragment_cache->Open(cache_dir, cache_size);
+        }
+        RenderParallel(r, jobs, nthreads);
+    }
+    if (r->out.IsOpen())
+        r->MakeTrailer();
+    if (dry_files > 1)
+        printf("%8d total\n", r->pagecount);
+    if (fragment_cache != NULL) {
+        fragment_cache->Trim();
+        fragment_cache->Report();
+    }
     exit(0);
 }
 
 
 /*
- * Check if kword is a reserved word
+ * Check if kword (len characters long) is a reserved word.  If it is and
+ * offset is non-null, *offset is set to the keyword's func_depth change.
  */
-int IsKeyword(char *kword) {
-    const char **ptr = NULL;
-    int iskey = FALSE;
-
-
-    switch (language) {
-
-        case LANG_CPP:
-        case LANG_C:
-        case LANG_VERA:
+template<int LANG>
+int Renderer::IsKeyword(const char *kword, int len, int *offset) {
+    const keyword_lookup_t *kt = (LANG == LANG_DEFINED) ? &lang_def->keywords : &keyword_lookup[LANG];
+    int k;
 
-            /*
-             * keywords can't occur on preprocessor lines
-             */
-            if ((obuffp > 0) && (obuffer[obuffp - 1] == '#'))
-                break;
+    /*
+     * keywords can't occur on preprocessor lines
+     */
+    if ((LANG == LANG_CPP || LANG == LANG_C || LANG == LANG_VERA) &&
+        (obuffp > 0) && (obuffer[obuffp - 1] == '#'))
+        return FALSE;
+    if (LANG == LANG_DEFINED && lang_def->image->directive != 0 &&
+        (obuffp > 0) && (obuffer[obuffp - 1] == lang_def->image->directive))
+        return FALSE;
 
-            /* fall through */
-
-        case LANG_TRELLIS:
-        case LANG_VERILOG:
-
-            /*
-             * search the appropriate keyword array
-             */
-            for (ptr = keyword_array[language]; *ptr != NULL; ptr++) {
-                if (strcmp(*ptr, kword) == 0) {
-                    iskey = TRUE;
-                    break;
-                }
-            }
-            break;
-
-    }
-    return iskey;
-}
+    if ((k = KwFind(kt, kword, len)) < 0)
+        return FALSE;
+    if (offset != NULL)
+        *offset = kt->offset[k];
+    return TRUE;
+}
 
 
 /*
  * Print usage help text when giving wrong command
  */
 void Usage() {
-    fprintf(stderr, "usage: %s\t[-text | -trellis | -c | -c++ | -verilog]\n", argv0);
-    fprintf(stderr, "\t\t[-proportional | -fixed] [-o outputfile]\n");
+    fprintf(stderr, "usage: %s\t[-text | -trellis | -c | -c++ | -verilog | -language name]\n", argv0);
+    fprintf(stderr, "\t\t[-lang definition-file]\n");
+    fprintf(stderr, "\t\t[-proportional | -fixed] [-o outputfile [-index indexfile]]\n");
+    fprintf(stderr, "\t\t[-shard-pages pages | -shards count]\n");
     fprintf(stderr, "\t\t[-letter | -a3 | -a4 | -legal | -ledger]\n");
     fprintf(stderr, "\t\t[-internal | -confidential | -restricted | -bottom string] \n");
-    fprintf(stderr, "\t\t[-duplex] [-rotate] [-1 | -2 | -4 | -8] files\n");
+    fprintf(stderr, "\t\t[-duplex] [-rotate] [-1 | -2 | -4 | -8]\n");
+    fprintf(stderr, "\t\t[-compact] [-compress | -flate] [-j threads] [-dry-run]\n");
+    fprintf(stderr, "\t\t[-cache directory [-cache-size megabytes]] files\n");
+    fprintf(stderr, "-cache also holds compiled -lang definitions, and must come before -lang\n");
     fprintf(stderr, "default: %s -c -proportional -letter (modified by environment variable C2PS_DEFAULTS)\n", argv0);
+    fprintf(stderr, "SOURCE_DATE_EPOCH, if set, is used for today's date and as the latest file date\n");
     exit(1);
 }
 
@@ -877,66 +1694,44 @@ void Usage() {
  *   10: Font for text files
  *   default: What font?
  */
-void WriteFont(int fn) {
-    switch (fn) {
-        case 1:
-            fprintf(outfile, "ordfn ");
-            break;
-        case 2:
-            fprintf(outfile, "keyfn ");
-            break;
-        case 3:
-            fprintf(outfile, "txtfn ");
-            break;
-        case 4:
-            fprintf(outfile, "comfn ");
-            break;
-        case 5:
-            fprintf(outfile, "linfn ");
-            break;
-        case 6:
-            fprintf(outfile, "botfn ");
-            break;
-        case 7:
-            fprintf(outfile, "topfn ");
-            break;
-        case 8:
-            fprintf(outfile, "prcfn ");
-            break;
-        case 9:
-            fprintf(outfile, "pagfn ");
-            break;
-        case 10:
-            fprintf(outfile, "filfn ");
-            break;
-        default:
-            if (process_mode == 1) WriteFont(10);
-            else if (txtmode) WriteFont(3);
-            else if (comment_style != 0) WriteFont(4);
-            else WriteFont(1);
+static const char *const font_procs[] = {
+        0, "ordfn ", "keyfn ", "txtfn ", "comfn ", "linfn ",
+        "botfn ", "topfn ", "prcfn ", "pagfn ", "filfn "};
+
+void Renderer::WriteFont(int fn) {
+    if (fn < 1 || fn > 10) {
+        if (process_mode == 1) fn = 10;
+        else if (txtmode) fn = 3;
+        else if (comment_style != 0) fn = 4;
+        else fn = 1;
     }
+    if (compact)
+        want_font = fn;     /* put off until something is shown */
+    else
+        out.Str(font_procs[fn]);
 }
 
+
 /*
- * Define the size of the PostScript BoundingBox depending on the papersize
+ * with -compact, select the font WriteFont() last asked for before
+ * showing a string, unless it is already current
  */
-void MakePaperSize() {
-    if (rotate_text) {
-        urx = paper_sizes[paper_size].y;
-        ury = paper_sizes[paper_size].x;
-    } else {
-        urx = paper_sizes[paper_size].x;
-        ury = paper_sizes[paper_size].y;
+void Renderer::SelectFont() {
+    if (want_font != cur_font) {
+        out.Str(font_procs[want_font]);
+        cur_font = want_font;
     }
+}
 
-    ypos = top = ury - NORMFSIZE - 90;
+/*
+ * Define the size of the PostScript BoundingBox depending on the papersize
+ */
+void Renderer::MakePaperSize() {
+    PaperBox(paper_size, rotate_text, &urx, &ury);
+    ypos = top = PageTop(ury);
     topline = top + 2 * LINEWIDTH;
-    rmarg = urx - 36;
-    /*
-     * 4.65 points per character (8 pt courier).
-     * round down to the nearest multiple of 8 characters
-     */
-    wrap_col = ((((rmarg - LMARG) * 100) / 465) / 8) * 8;
+    rmarg = RightMargin(urx);
+    wrap_col = WrapColumn(rmarg);
 }
 
 
@@ -963,14 +1758,13 @@ static const char *wday[7] = {
         "Friday",
         "Saturday"};
 
-time_t todays_date;
-
 /*
  * set the time buffer to the file timestamp or today's date
  */
-void ResetTimbuf() {
+void Renderer::ResetTimbuf() {
     struct tm *lt;
 #ifndef VMS
+    struct tm tmbuf;
     struct stat statb;
 #endif
 
@@ -978,7 +1772,7 @@ void ResetTimbuf() {
     lt = localtime(&todays_date);
 #else
     if (infile == NULL) {
-        lt = localtime(&todays_date);
+        lt = localtime_r(&todays_date, &tmbuf);
     } else {
         if (fstat(fileno(infile), &statb) != 0) {
 #ifdef VMS
@@ -987,7 +1781,10 @@ void ResetTimbuf() {
             fprintf(stderr, "%s: on '%s' #1 can't fstat(%d): %s\n", argv0, ifname, fileno(infile), strerror(errno));
 #endif
         }
-        lt = localtime(&statb.st_mtime);
+        /* with SOURCE_DATE_EPOCH, nothing is dated later than it */
+        if (date_epoch >= 0 && statb.st_mtime > date_epoch)
+            statb.st_mtime = date_epoch;
+        lt = localtime_r(&statb.st_mtime, &tmbuf);
     }
 #endif
     if ((lt->tm_min == 0) && (lt->tm_sec == 0)
@@ -1015,198 +1812,371 @@ void ResetTimbuf() {
 /*
  * emit the PostScript Prolog
  */
-void MakeProlog() {
-    struct tm *lt;
-
-    time(&todays_date);
-    lt = localtime(&todays_date);
-
-    fprintf(outfile, "%%!PS-Adobe-2.0 EPSF-2.0\n");
-    fprintf(outfile, "%%%%BoundingBox: 0 0 %d %d\n", urx, ury);
-    fprintf(outfile, "%%%%DocumentFonts: Courier");
+void Renderer::MakeProlog() {
+    struct tm *lt,
+            tmbuf;
+    int k;
+
+    if (shard <= 1) {               /* later shards keep the first one's date */
+        if (date_epoch >= 0)
+            todays_date = date_epoch;   /* reproducible output */
+        else
+            time(&todays_date);
+    }
+    lt = localtime_r(&todays_date, &tmbuf);
+
+    /* coordinates were swapped earlier, so with -rotate the paper is ury by urx */
+    out.Printf("%%!PS-Adobe-3.0\n");
+    out.Printf("%%%%BoundingBox: 0 0 %d %d\n", rotate_text ? ury : urx, rotate_text ? urx : ury);
+    out.Printf("%%%%Orientation: %s\n", rotate_text ? "Landscape" : "Portrait");
+    if (compress)
+        out.Printf("%%%%LanguageLevel: %d\n", compress == COMPRESS_FLATE ? 3 : 2);
+    else if (duplex)
+        out.Printf("%%%%LanguageLevel: 2\n");
+    out.Printf("%%%%DocumentFonts: Courier");
     if (fixed_font) {
-        fprintf(outfile, " Courier-Oblique");
-        fprintf(outfile, " Courier-Bold");
+        out.Printf(" Courier-Oblique");
+        out.Printf(" Courier-Bold");
     } else {
-        fprintf(outfile, " Times-Italic");
-        fprintf(outfile, " Times-Bold");
-        fprintf(outfile, " Times-Roman");
-    }
-    fprintf(outfile, " Helvetica-Oblique\n");
-    fprintf(outfile, "%%%%Title: %s\n", ofname);
-    fprintf(outfile, "%%%%Creator: %s %s\n", argv0, rcs_ident);
-    fprintf(outfile, "%%%%CreationDate: %s %s %d %02d:%02d:%02d %d\n",
+        out.Printf(" Times-Italic");
+        out.Printf(" Times-Bold");
+        out.Printf(" Times-Roman");
+    }
+    out.Printf(" Helvetica-Oblique\n");
+    out.Printf("%%%%Title: %s\n", doc_name);
+    out.Printf("%%%%Creator: %s %s\n", argv0, rcs_ident);
+    out.Printf("%%%%CreationDate: %s %s %d %02d:%02d:%02d %d\n",
             wday[lt->tm_wday], month[lt->tm_mon], lt->tm_mday,
             lt->tm_hour, lt->tm_min, lt->tm_sec, lt->tm_year + 1900);
-    fprintf(outfile, "%%%%Pages: (atend)\n");
-    fprintf(outfile, "%%%%EndComments\n");
+    out.Printf("%%%%Pages: (atend)\n");
+    out.Printf("%%%%EndComments\n");
+    out.Printf("%%%%BeginProlog\n");
 
     /* define the newfont procedure, stack: fontsize font */
-    fprintf(outfile, "/nf {findfont exch scalefont setfont} def\n");
+    out.Printf("/nf {findfont exch scalefont setfont} def\n");
     /* define other the fonts procedures */
     if (fixed_font) {
-        fprintf(outfile, "/keyfn {%d /Courier-Bold nf} def\n", NORMFSIZE);
-        fprintf(outfile, "/ordfn {%d /Courier nf} def\n", NORMFSIZE);
-        fprintf(outfile, "/comfn {%d /Courier-Oblique nf} def\n", NORMFSIZE);
+        out.Printf("/keyfn {%d /Courier-Bold nf} def\n", NORMFSIZE);
+        out.Printf("/ordfn {%d /Courier nf} def\n", NORMFSIZE);
+        out.Printf("/comfn {%d /Courier-Oblique nf} def\n", NORMFSIZE);
     } else {
-        fprintf(outfile, "/keyfn {%d /Times-Bold nf} def\n", NORMFSIZE);
-        fprintf(outfile, "/ordfn {%d /Times-Roman nf} def\n", NORMFSIZE);
-        fprintf(outfile, "/comfn {%d /Times-Italic nf} def\n", NORMFSIZE);
-    }
-    fprintf(outfile, "/txtfn {%d /Courier nf } def\n", NORMFSIZE);
-    fprintf(outfile, "/filfn {%d /Courier nf } def\n", SMALLFSIZE);
-    fprintf(outfile, "/linfn {%d /Helvetica-Oblique nf} def\n", SMALLFSIZE);
-    fprintf(outfile, "/botfn {%d /Helvetica-Oblique nf} def\n", BIGFSIZE);
-    fprintf(outfile, "/topfn {%d /Helvetica-Oblique nf} def \n", BIGFSIZE);
-    fprintf(outfile, "/prcfn {%d /Helvetica-Oblique nf} def \n", BIGFSIZE);
-    fprintf(outfile, "/pagfn {%d /Helvetica-Oblique nf} def \n", 2 * BIGFSIZE);
+        out.Printf("/keyfn {%d /Times-Bold nf} def\n", NORMFSIZE);
+        out.Printf("/ordfn {%d /Times-Roman nf} def\n", NORMFSIZE);
+        out.Printf("/comfn {%d /Times-Italic nf} def\n", NORMFSIZE);
+    }
+    out.Printf("/txtfn {%d /Courier nf } def\n", NORMFSIZE);
+    out.Printf("/filfn {%d /Courier nf } def\n", SMALLFSIZE);
+    out.Printf("/linfn {%d /Helvetica-Oblique nf} def\n", SMALLFSIZE);
+    out.Printf("/botfn {%d /Helvetica-Oblique nf} def\n", BIGFSIZE);
+    out.Printf("/topfn {%d /Helvetica-Oblique nf} def \n", BIGFSIZE);
+    out.Printf("/prcfn {%d /Helvetica-Oblique nf} def \n", BIGFSIZE);
+    out.Printf("/pagfn {%d /Helvetica-Oblique nf} def \n", 2 * BIGFSIZE);
     /* define the show procedure */
-    fprintf(outfile, "/s /show load def\n");
-    /* define the rightshow procedure, stack: string */
-    fprintf(outfile, "/rs {dup stringwidth pop neg 0 rmoveto s} def\n");
-    /* define the centershow procedure, stack: string */
-    fprintf(outfile, "/cs {dup stringwidth pop neg 2 div 0 rmoveto s} def\n");
+    out.Printf("/s /show load def\n");
     /* define the moveto procedure */
-    fprintf(outfile, "/m /moveto load def\n");
+    out.Printf("/m /moveto load def\n");
     /* define the lineto  procedure */
-    fprintf(outfile, "/l {newpath moveto lineto stroke} def\n");
-    WriteFont(1);
-    if (duplex) {
-        fprintf(outfile, "<< /Duplex true >> setpagedevice\n");
+    out.Printf("/l {newpath moveto lineto stroke} def\n");
+    /*
+     * what every page has: R the rules, B a bottom text (stack: string x),
+     * D the rules and the bottom text as it is now, T the top line (stack:
+     * page-number x file-name x date) and E the blank page text.  The x's
+     * come from RightX().
+     */
+    out.Printf("/R {%d %d %d %d l %d %d %d %d l} def\n",
+            LMARG - 4, topline - 4, rmarg + 4, topline - 4,
+            LMARG - 4, BOTLINE, LMARG - 4, topline + BIGFSIZE + BIGFSIZE + 4);
+    out.Printf("/B {botfn %d m s} def\n", BOTLINE);
+    if (shard <= 1)
+        prolog_bottom = bottom_text;    /* pages rendered already may count on it */
+    if (prolog_bottom != 0) {
+        out.Lit("/D {");
+        RightX(prolog_bottom, rmarg, 6, BIGFSIZE);
+        out.Lit(" B R} def\n");
+    } else
+        out.Printf("/D /R load def\n");
+    out.Printf("/T {topfn %d %d m s %d m s pagfn %d m s} def\n",
+            LMARG, topline + LINEWIDTH + 4, topline, topline + LINEWIDTH + 4);
+    out.Lit("/E {topfn ");
+    out.Milli((LMARG + (rmarg - LMARG) / 2) * 1000 -
+              HelveticaWidth(BLANK_PAGE_TEXT, strlen(BLANK_PAGE_TEXT)) * BIGFSIZE / 2);
+    out.Printf(" %d m (%s)s} def\n", BOTLINE + (topline - BOTLINE) / 2, BLANK_PAGE_TEXT);
+    /*
+     * the line numbers of a page, stack: [number y number y ...]; every
+     * digit is as wide as '0'
+     */
+    out.Printf("/gb 12 string def\n");
+    out.Lit("/G {linfn aload length 2 idiv {exch gb cvs dup length ");
+    out.Milli(helvetica_widths['0'] * SMALLFSIZE);
+    out.Printf(" mul %d exch sub 3 -1 roll m s} repeat} def\n", LMARG - 8);
+    if (compact) {
+        /* start line y: y L, the next line: n, k lines further down: k N */
+        out.Printf("/y 0 def\n");
+        out.Printf("/L {dup /y exch def %d exch moveto} def\n", LMARG);
+        out.Printf("/n {y %d sub L} def\n", LINEWIDTH);
+        out.Printf("/N {%d mul y exch sub L} def\n", LINEWIDTH);
+        /* show a keyword, or a common one, and go back to ordfn */
+        out.Printf("/k {keyfn s ordfn} def\n");
+        for (k = 0; compact_keywords[k] != 0; k++)
+            out.Printf("/K%d {(%s)k} def\n", k, compact_keywords[k]);
+    }
+    if (compress) {
+        /* run the compressed page that follows, and skip to its ~> */
+        out.Printf("/Z {currentfile /ASCII85Decode filter dup /%s filter cvx exec\n",
+                compress == COMPRESS_FLATE ? "FlateDecode" : "LZWDecode");
+        out.Printf("    {dup read {pop} {exit} ifelse} loop pop} def\n");
     }
-    if (rotate_text) {
-        /* coordinates were swapped earlier so this is really urx */
-        fprintf(outfile, "%d 0 translate 90 rotate\n", ury);
+    /*
+     * P and Q start and end every page (see PageComment()), which saves
+     * and restores everything else it does: no page depends on another
+     */
+    if (rotate_text)
+        out.Printf("/P {/pgsave save def %d 0 translate 90 rotate} def\n", ury);
+    else
+        out.Printf("/P {/pgsave save def} def\n");
+    out.Printf("/Q {pgsave restore showpage} def\n");
+    out.Printf("\n%%%%EndProlog\n");
+    if (duplex) {
+        out.Printf("%%%%BeginSetup\n");
+        out.Printf("<< /Duplex true >> setpagedevice\n");
+        out.Printf("%%%%EndSetup\n");
     }
-    fprintf(outfile, "\n%%%%EndProlog\n");
 }
 
 
+#define AFS_PREFIX "/xyzzy/"
+
 /*
  * print the current page
  */
-void PrintPage() {
+void Renderer::PrintPage() {
+    char page[12];
 
-    if (bottom_text != 0) {
-        /*
-         * bottom of page text
-         */
-        WriteFont(6);
-        fprintf(outfile, "%d %d m ", rmarg, BOTLINE);
-        fprintf(outfile, "(%s)rs\n", bottom_text);
-    }
+    WriteGutter();
 
     /*
-     * top of page text
+     * top of page text: the date, the file name and the page number
      */
-    WriteFont(7);
-    fprintf(outfile, "%d %d m (%s)s ", LMARG, topline + LINEWIDTH + 4, timbuf);
-#define AFS_PREFIX "/xyzzy/"
+    snprintf(page, sizeof(page), "%d", pageno);
+    RightX(page, rmarg, 9, 2 * BIGFSIZE);
+    out.Char(' ');
     if (strncmp(ifname_full, AFS_PREFIX, strlen(AFS_PREFIX)) == 0)
-        fprintf(outfile, "%d %d m (%s)rs\n", rmarg, topline, &ifname_full[strlen(AFS_PREFIX) - strlen("/home/")]);
+        RightX(&ifname_full[strlen(AFS_PREFIX) - strlen("/home/")], rmarg, 7, BIGFSIZE);
     else
-        fprintf(outfile, "%d %d m (%s)rs\n", rmarg, topline, ifname_full);
-    WriteFont(9);
-    fprintf(outfile, "%d %d m (%d)rs\n", rmarg, topline + LINEWIDTH + 4, pageno);
-    /*
-     * top of page separator line
-     */
-    fprintf(outfile, "%d %d %d %d l\n", LMARG - 4, topline - 4, rmarg + 4, topline - 4);
-    /*
-     * left vertical rule
-     */
-    fprintf(outfile, "%d %d %d %d l\n", LMARG - 4, BOTLINE, LMARG - 4, topline + BIGFSIZE + BIGFSIZE + 4);
+        RightX(ifname_full, rmarg, 7, BIGFSIZE);
+    out.Lit(" (");
+    out.Str(timbuf);
+    out.Lit(")T ");
+    WriteDecorations();
+    EndPage();
+}
+
+
+/*
+ * the bottom of page text and the rules, from the prolog's D unless the
+ * bottom text has changed since
+ */
+void Renderer::WriteDecorations() {
+    const char *prolog = (prolog_bottom != 0) ? prolog_bottom : "",
+            *now = (bottom_text != 0) ? bottom_text : "";
+
+    if (strcmp(prolog, now) == 0) {
+        out.Lit("D\n");
+    } else if (*now == '\0') {
+        out.Lit("R\n");
+    } else {
+        RightX(now, rmarg, 6, BIGFSIZE);
+        out.Lit(" B R\n");
+    }
+    cur_font = 0;           /* B, T and E change it */
+}
+
+
+/*
+ * emit the DSC comments that start a page, or note where its %%Page goes
+ * if we are rendering a Fragment, and its setup
+ */
+void Renderer::PageComment() {
+    cur_font = 0;           /* each page sets up its own font and position */
+    line_y = -1;
+    if (page_marks != NULL) {
+        page_marks->push_back(out.Tell());
+    } else {
+        ShardBreak();
+        if (index_name != NULL)
+            page_offsets.push_back(out.Tell());
+        out.Printf("%%%%Page: %d %d\n", pagecount, pagecount);
+    }
+    out.Lit("%%PageBoundingBox: 0 0 ");
+    out.Int(rotate_text ? ury : urx);
+    out.Char(' ');
+    out.Int(rotate_text ? urx : ury);
+    out.Lit("\n%%BeginPageSetup\nP\n%%EndPageSetup\n");
+    if (compress) {
+        /* collect the page body for EndPage() */
+        if (!page_body.IsOpen())
+            page_body.Open(-1, ifname);
+        out.Swap(page_body);
+    }
+}
 
-    curfuncs[0] = '\0';     /* not currently using this, but... */
-    fprintf(outfile, "showpage\n");
-    if (rotate_text) {
-        /* coordinates were swapped earlier so this is really urx */
-        fprintf(outfile, "%d 0 translate 90 rotate\n", ury);
+
+/*
+ * finish a page started by PageComment(), compressing it with -compress
+ */
+void Renderer::EndPage() {
+    if (compress) {
+        out.Swap(page_body);
+        encoder.Encode(out, compress, page_body.Data(), page_body.Tell());
+        page_body.Rewind();
     }
+    out.Lit("Q\n");
 }
 
 
 /*
  * set up a new page
  */
-void MakeNewPage() {
+void Renderer::MakeNewPage() {
     pageno++;
     pagecount++;
     top_of_page = TRUE;
-    fprintf(outfile, "%%%%Page: %d %d\n", pagecount, pagecount);
+    PageComment();
     /*
      * if in the middle of a function, print continuation name
      */
     if (func_depth > 0 && have_funcname == FALSE) {
+        char cont[sizeof(funcname) + 3];
+
         WriteFont(8);
-        fprintf(outfile, "%d %d m (...%s)rs\n", rmarg, top, funcname);
+        SelectFont();
+        snprintf(cont, sizeof(cont), "...%s", funcname);
+        RightX(cont, rmarg, 8, BIGFSIZE);
+        out.Char(' ');
+        out.Int(top);
+        out.Lit(" m s\n");
     }
     WriteFont(0);
 }
 
-void PrintBlankPage() {
+void Renderer::PrintBlankPage() {
 
     /* from MakeNewPage() */
     pageno++;
     pagecount++;
     top_of_page = TRUE;
-    fprintf(outfile, "%%%%Page: %d %d\n", pagecount, pagecount);
+    PageComment();
 
     /* from PrintPage() */
-    if (bottom_text != 0) {
-        /*
-         * bottom of page text
-         */
-        WriteFont(6);
-        fprintf(outfile, "%d %d m ", rmarg, BOTLINE);
-        fprintf(outfile, "(%s)rs\n", bottom_text);
-    }
+    out.Lit("E ");
+    WriteDecorations();
+    EndPage();
+}
 
-    /*
-     * center of page text
-     */
-    WriteFont(7);
-    fprintf(outfile, "%d %d m (This Page Intentionally Blank)cs ",
-            LMARG + (rmarg - LMARG) / 2, BOTLINE + (topline - BOTLINE) / 2);
 
-    /*
-     * top of page separator line
-     */
-    fprintf(outfile, "%d %d %d %d l\n", LMARG - 4, topline - 4, rmarg + 4, topline - 4);
-    /*
-     * left vertical rule
-     */
-    fprintf(outfile, "%d %d %d %d l\n", LMARG - 4, BOTLINE, LMARG - 4, topline + BIGFSIZE + BIGFSIZE + 4);
+/*
+ * write the output buffer to the file
+ */
+void Renderer::WriteBuffer() {
+    if (compact && obuffp == 0)
+        return;
+    SelectFont();
+    out.Char('(');
+    out.Write(obuffer, obuffp);
+    out.Lit(")s\n");
+    obuffp = 0;
+}
+
+
+/*
+ * move to x, y
+ */
+void Renderer::MoveTo(int x, int y) {
+    out.Int(x);
+    out.Char(' ');
+    out.Int(y);
+    out.Lit(" m ");
+}
 
-    curfuncs[0] = '\0';     /* not currently using this, but... */
-    fprintf(outfile, "showpage\n");
-    if (rotate_text) {
-        /* coordinates were swapped earlier so this is really urx */
-        fprintf(outfile, "%d 0 translate 90 rotate\n", ury);
+
+/*
+ * move to the start of the line at ypos; -compact steps down from the
+ * line before with n or N rather than giving both coordinates
+ */
+void Renderer::MoveToLine() {
+    int lines;
+
+    if (!compact) {
+        MoveTo(LMARG, ypos);
+    } else if (line_y > ypos && (line_y - ypos) % LINEWIDTH == 0) {
+        lines = (line_y - ypos) / LINEWIDTH;
+        if (lines == 1) {
+            out.Lit("n ");
+        } else {
+            out.Int(lines);
+            out.Lit(" N ");
+        }
+    } else {
+        out.Int(ypos);
+        out.Lit(" L ");
     }
+    line_y = ypos;
 }
 
 
 /*
- * write the output buffer to the file
+ * write (str) and the x at which it has to start to end at rx in font fn,
+ * Helvetica-Oblique at size points.  The x is worked out here from the
+ * font metrics, or left to stringwidth for a str with a character whose
+ * width isn't known or a '\\', which PostScript reads as an escape.
  */
-void WriteBuffer() {
-    obuffer[obuffp] = '\0';
-    fprintf(outfile, "(%s)s\n", obuffer);
-    obuffp = 0;
+void Renderer::RightX(const char *str, int rx, int fn, int size) {
+    size_t n = strlen(str);
+    int w = (memchr(str, '\\', n) == NULL) ? HelveticaWidth(str, n) : -1;
+
+    out.Char('(');
+    out.Write(str, n);
+    out.Char(')');
+    if (w >= 0) {
+        out.Milli(rx * 1000 - w * size);
+    } else {
+        out.Str(font_procs[fn]);
+        out.Lit("dup stringwidth pop neg ");
+        out.Int(rx);
+        out.Lit(" add");
+    }
 }
 
 
 /*
- * write the linenumber on the right side
+ * note the linenumber for the left margin of the page, which
+ * WriteGutter() puts out
  */
-void WriteLineNo(int ln) {
+void Renderer::WriteLineNo(int ln) {
     if (ypos > BOTTOM) {
-        fprintf(outfile, "%d %d m ", LMARG - 8, ypos);
-        WriteFont(5);
-        fprintf(outfile, "(%d)rs\n", ln);
-        WriteFont(0);
+        gutter.push_back(ln);
+        gutter.push_back(ypos);
+    }
+}
+
+
+/*
+ * write the page's line numbers as one array for G, rather than a move,
+ * two font changes and a show for each
+ */
+void Renderer::WriteGutter() {
+    if (gutter.empty())
+        return;
+    out.Char('[');
+    for (size_t k = 0; k < gutter.size(); k++) {
+        if (k > 0)
+            out.Char(' ');
+        out.Int(gutter[k]);
     }
+    out.Lit("]G\n");
+    gutter.clear();
+    if (compact)
+        cur_font = 5;       /* G leaves linfn selected */
 }
 
 
@@ -1216,10 +2186,14 @@ void WriteLineNo(int ln) {
  * put characters in output buffer escaping magic postscript characters
  * and supressing nul, newline, return and formfeed
  */
-void WhatToPutIn(char c) {
+void Renderer::WhatToPutIn(char c) {
     int tmpi,
             tmpj;
 
+    /* keep each string shown within the PostScript string size limit */
+    if (obuffp >= MAXSHOWLEN)
+        WriteBuffer();
+
     switch (c) {
 
         case '\\':
@@ -1251,14 +2225,87 @@ void WhatToPutIn(char c) {
 }
 
 
+/*
+ * put the characters from p on in the output buffer just as WhatToPutIn()
+ * would one at a time, up to end or the first that ends the line or is a
+ * or b, and return where it stopped.  The runs that need no escaping are
+ * found with ScanTextSpecialOr() and copied whole, and the characters
+ * between them are escaped or expanded here without a call for each.
+ */
+const char *Renderer::PutText(const char *p, const char *end, char a, char b) {
+    const char *run;
+    int n;
+    char c;
+
+    for (;;) {
+        run = p;
+        p = ScanTextSpecialOr(p, end, a);
+        if (p > run)
+            CopyToBuffer(run, p - run);
+        for (; p < end; p++) {
+            c = *p;
+            if (c == a || c == b || c == '\n' || c == '\r' || c == '\f' || c == '\0')
+                return p;
+            if (!IsTextSpecial((unsigned char) c))
+                break;
+            if (obuffp >= MAXSHOWLEN)
+                WriteBuffer();
+            if (c == '\t') {
+                n = 8 - x % 8;
+                memset(obuffer + obuffp, ' ', n);
+                obuffp += n;
+                x += n;
+            } else {
+                if (c == '\\' || c == '(' || c == ')')
+                    PutCharInBuffer('\\');
+                PutCharInBuffer(c);
+                x++;
+            }
+        }
+        if (p == end)
+            return p;
+    }
+}
+
+
+/*
+ * copy n characters that need no escaping to the output buffer, writing
+ * it out each time it fills up
+ */
+void Renderer::CopyToBuffer(const char *p, size_t n) {
+    size_t k;
+
+    x += n;
+    while (n > 0) {
+        if (obuffp >= MAXSHOWLEN)
+            WriteBuffer();
+        k = std::min(n, (size_t) (MAXSHOWLEN - obuffp));
+        memcpy(obuffer + obuffp, p, k);
+        obuffp += k;
+        p += k;
+        n -= k;
+    }
+}
+
+
+/*
+ * put the rest of a comment or string in the output buffer, from
+ * ibuffer[ibuffp] up to the end of the line or the first a or b, and
+ * leave ibuffp on the last character put.  ibuffer[ibuffp] itself must
+ * be neither.
+ */
+void Renderer::PutRun(char a, char b) {
+    const char *run = ibuffer + ibuffp;
+
+    ibuffp += PutText(run, ibuffer + input.LineLength(), a, b) - run - 1;
+}
+
+
 /*
  * put the current word in the output buffer
  */
-void PutWordInBuffer() {
-    obuffer[obuffp] = '\0';
-    strcat(obuffer, cword);
-    obuffp += strlen(cword);
-    x += strlen(cword);
+void Renderer::PutWordInBuffer() {
+    CopyToBuffer(cword, cwordlen);
     cwordp = 0;
 }
 
@@ -1266,12 +2313,31 @@ void PutWordInBuffer() {
 /*
  * The last word was a keyword, switch fonts and emit it.
  */
-void WasKeyword() {
+void Renderer::WasKeyword() {
+    int k;
+
     WriteBuffer();
-    WriteFont(2);
-    fprintf(outfile, "(%s)s ", cword);
-    WriteFont(1);
-    fprintf(outfile, "\n");
+    if (compact) {
+        if ((k = KwFind(&compact_lookup, cword, cwordlen)) >= 0) {
+            out.Char('K');
+            out.Int(k);
+            out.Char(' ');
+        } else {
+            out.Char('(');
+            out.Write(cword, cwordlen);
+            out.Lit(")k ");
+        }
+        cur_font = 1;       /* k leaves ordfn selected */
+        WriteFont(1);
+    } else {
+        WriteFont(2);
+        SelectFont();
+        out.Char('(');
+        out.Write(cword, cwordlen);
+        out.Lit(")s ");
+        WriteFont(1);
+        out.Char('\n');
+    }
 /*    WhatToPutIn(ibuffer[ibuffp]); */
     cwordp = 0;
 }
@@ -1280,29 +2346,33 @@ void WasKeyword() {
 /*
  * return true if the current line begins a function
  */
-int IsItAFunc(int comment,  /* style of comment we're in (0 in not in a comment) */
-              int tmp,      /* lookahead pointer into temporary buffer */
+int Renderer::IsItAFunc(const char *buf, /* line being scanned */
+              int comment,  /* style of comment we're in (0 in not in a comment) */
+              int tmp,      /* lookahead pointer into buf */
               int par,      /* number of unclosed parens we have seen */
-              int seen,     /* number of lines looked ahead */
-              int lines_seen)   /* true if we have seen an open paren */
+              int seen,     /* true if we have seen an open paren */
+              int lines_seen)   /* number of lines looked ahead */
 {
-    long ptrpos;
+    const char *next;
+    int skip;
 
     /*
      * bail out if function prolog too long
      */
-    if (lines_seen > 20)
+    if (lines_seen > 20) {
+        OpenParensUntil(lineno + 20);
         return FALSE;
+    }
 
-    while (tmp < MAXCHARSINLINE) {
+    for (;;) {
         if (comment != 0) {
-            switch (tmpbuffer[tmp]) {
-                case '*':
-                    if (comment == COMMENT_END_STAR_SLASH) {
-                        if (tmpbuffer[tmp + 1] == '/') {
-                            comment = 0;
+            switch (buf[tmp]) {
+                default:
+                    if (comment == COMMENT_END_STAR_SLASH && buf[tmp] == comment_close[0] &&
+                        (comment_close[1] == '\0' || buf[tmp + 1] == comment_close[1])) {
+                        comment = 0;
+                        if (comment_close[1] != '\0')
                             tmp++;
-                        }
                     }
                     break;
                 case '\n':
@@ -1312,53 +2382,51 @@ int IsItAFunc(int comment,  /* style of comment we're in (0 in not in a comment)
                     if (comment == COMMENT_END_NEWLINE) {
                         comment = 0;
                     }
-                    ptrpos = ftell(infile);
-                    if ((fgets(tmpbuffer, MAXCHARSINLINE, infile)) == NULL
-                        && ferror(infile) != 0) {
-#ifdef VMS
-                        perror(argv0);
-#else
-                        fprintf(stderr, "%s: on '%s' #2 can't fgets(infile): %s\n", argv0, ifname, strerror(errno));
-#endif
-                        return FALSE;
-                    }
-                    if (IsItAFunc(comment, 0, par, seen, lines_seen + 1)) {
-                        if (fseek(infile, ptrpos, 0) != 0) {
-#ifdef VMS
-                            perror(argv0);
-#else
-                            fprintf(stderr, "%s: on '%s' #3 can't fseek to %lu: %s\n", argv0, ifname, ptrpos,
-                                    strerror(errno));
-#endif
-                        }
-                        return TRUE;
-                    } else {
-                        if (fseek(infile, ptrpos, 0) != 0) {
+                    if ((next = input.PeekLine(lines_seen + 1)) == NULL) {
+                        if (input.Error() != 0) {
 #ifdef VMS
                             perror(argv0);
 #else
-                            fprintf(stderr, "%s: on '%s' #4 can't fseek to %lu: %s\n", argv0, ifname, ptrpos,
-                                    strerror(errno));
+                            fprintf(stderr, "%s: on '%s' #2 can't read: %s\n", argv0, ifname, strerror(input.Error()));
 #endif
+                            return FALSE;
                         }
-                        return FALSE;
+                        next = buf;     /* at end of file, rescan the last line */
+                        scan_rescanned = TRUE;
                     }
+                    return IsItAFunc(next, comment, 0, par, seen, lines_seen + 1);
             }
         } else {
 
 #define DEFAULT_ACTION { if (!seen) return FALSE; else if (par == 0 && seen) return TRUE; }
 
-            switch (tmpbuffer[tmp]) {
+            if (language == LANG_DEFINED &&
+                lang_def->image->lex.cls[(unsigned char) buf[tmp]] == LX_COMMENT) {
+                if ((skip = Opens(&buf[tmp], lang_def->image->block_open)) > 0)
+                    comment = COMMENT_END_STAR_SLASH;
+                else if ((skip = Opens(&buf[tmp], lang_def->image->line_comment)) > 0)
+                    comment = COMMENT_END_NEWLINE;
+                else {
+                    /* as for a C '/' that isn't a comment */
+                    OpenParensUntil(INT_MAX);
+                    return FALSE;
+                }
+                tmp += skip;
+                continue;
+            }
+
+            switch (buf[tmp]) {
                 case '/':
                     if ((language == LANG_C) || (language == LANG_CPP) || (language == LANG_VERILOG) ||
                         (language == LANG_VERA)) {
-                        if (tmpbuffer[tmp + 1] == '/') {
+                        if (buf[tmp + 1] == '/') {
                             comment = COMMENT_END_NEWLINE;
                             tmp++;
-                        } else if (tmpbuffer[tmp + 1] == '*') {
+                        } else if (buf[tmp + 1] == '*') {
                             comment = COMMENT_END_STAR_SLASH;
                             tmp++;
                         } else {
+                            OpenParensUntil(INT_MAX);
                             return FALSE;
                         }
                     } else DEFAULT_ACTION;
@@ -1370,12 +2438,35 @@ int IsItAFunc(int comment,  /* style of comment we're in (0 in not in a comment)
                     } else DEFAULT_ACTION;
                     break;
 
+                /*
+                 * a paren that takes par further from 0 starts a stretch
+                 * that can only end the scan with FALSE, and can be skipped
+                 * to its match if an earlier scan found it
+                 */
                 case '(':
                     seen = TRUE;
+                    if (par >= 0) {
+                        if ((skip = SkipToMatch(&buf, &tmp, &lines_seen)) < 0)
+                            return FALSE;
+                        if (skip > 0)
+                            break;
+                        open_parens.push_back({lineno + lines_seen, tmp});
+                    } else
+                        MatchParen(lineno + lines_seen, tmp);
                     par++;
                     break;
 
                 case ')':
+                    if (par <= 0 && seen) {
+                        if ((skip = SkipToMatch(&buf, &tmp, &lines_seen)) < 0)
+                            return FALSE;
+                        if (skip > 0)
+                            break;
+                    }
+                    if (par > 0)
+                        MatchParen(lineno + lines_seen, tmp);
+                    else
+                        open_parens.push_back({lineno + lines_seen, tmp});
                     par--;
                     break;
 
@@ -1389,38 +2480,11 @@ int IsItAFunc(int comment,  /* style of comment we're in (0 in not in a comment)
                 case '\f':
                 case '\r':
                 case '\0':
-                    ptrpos = ftell(infile);
-                    if ((fgets(tmpbuffer, MAXCHARSINLINE, infile)) == NULL) {
-                        return FALSE;
-#if 0
-#ifdef VMS
-                        perror(argv0);
-#else
-                        fprintf(stderr, "%s: on '%s' #5 can't fgets, ptrpos=%d: %s\n", argv0, ifname, ptrpos, strerror(errno));
-#endif
-#endif
-                    }
-                    if (IsItAFunc(comment, 0, par, seen, lines_seen + 1)) {
-                        if (fseek(infile, ptrpos, 0) != 0) {
-#ifdef VMS
-                            perror(argv0);
-#else
-                            fprintf(stderr, "%s: on '%s' #6 can't fseek to %lu: %s\n", argv0, ifname, ptrpos,
-                                    strerror(errno));
-#endif
-                        }
-                        return TRUE;
-                    } else {
-                        if (fseek(infile, ptrpos, 0) != 0) {
-#ifdef VMS
-                            perror(argv0);
-#else
-                            fprintf(stderr, "%s: on '%s' #7 can't fseek to %lu: %s\n", argv0, ifname, ptrpos,
-                                    strerror(errno));
-#endif
-                        }
+                    if ((next = input.PeekLine(lines_seen + 1)) == NULL) {
+                        OpenParensUntil(INT_MAX);
                         return FALSE;
                     }
+                    return IsItAFunc(next, comment, 0, par, seen, lines_seen + 1);
 
                 case ' ':
                 case '\t':
@@ -1432,69 +2496,113 @@ int IsItAFunc(int comment,  /* style of comment we're in (0 in not in a comment)
         }
         tmp++;
     }
-    return FALSE;
 }
 
 #undef DEFAULT_ACTION
 
+/*
+ * the ParenMatches for line number line, emptied first if they were last
+ * used for another one
+ */
+std::unordered_map<int, std::pair<int, int>> &Renderer::ParenMatchesOn(int line) {
+    ParenMatches &pm = paren_matches[line % MATCH_LINES];
+
+    if (pm.line != line) {
+        pm.line = line;
+        pm.close.clear();
+    }
+    return pm.close;
+}
+
+/*
+ * if an earlier scan found where the paren at column *tmp of *buf is
+ * matched, move this one there and return 1, or return -1 if it would
+ * run out of lines first.  Return 0 if it has to walk the parens itself.
+ */
+int Renderer::SkipToMatch(const char **buf, int *tmp, int *lines_seen) {
+    std::unordered_map<int, std::pair<int, int>> &matches = ParenMatchesOn(lineno + *lines_seen);
+    auto m = matches.find(*tmp);
+    int to_line,
+            to_col;
+
+    if (m == matches.end())
+        return 0;
+    to_line = m->second.first;
+    to_col = m->second.second;
+    if (to_col < 0) {
+        if (to_line < lineno + 20)
+            return 0;
+        OpenParensUntil(to_line);
+        return -1;
+    }
+    if (to_line > lineno + 20) {
+        OpenParensUntil(lineno + 20);
+        return -1;
+    }
+    if (to_line != lineno + *lines_seen) {
+        *lines_seen = to_line - lineno;
+        *buf = input.PeekLine(*lines_seen);
+    }
+    *tmp = to_col;
+    return 1;
+}
+
+/*
+ * the paren at line, col matches the last one the scan left open.  Short
+ * pairs cost less to walk again than to remember.
+ */
+void Renderer::MatchParen(int line, int col) {
+    if (open_parens.empty())
+        return;
+    std::pair<int, int> &open = open_parens.back();
+    if (!scan_rescanned && (open.first != line || col - open.second >= MATCH_MIN_COLS))
+        ParenMatchesOn(open.first)[open.second] = {line, col};
+    open_parens.pop_back();
+}
+
+/*
+ * the scan is giving up with parens open: none of them is matched on or
+ * before line (INT_MAX for not at all, or not without a '/' in between)
+ */
+void Renderer::OpenParensUntil(int line) {
+    if (!scan_rescanned)
+        for (auto &p : open_parens)
+            ParenMatchesOn(p.first)[p.second] = {line, -1};
+    open_parens.clear();
+}
+
 /*
  * last word was a function name, remember is so it can be written on
  * the right-hand side of the page
  */
-void WasAFunc() {
+void Renderer::WasAFunc() {
     //printf("function: %s, %d->%d\n", cword, have_funcname, TRUE);
-    strcpy(funcname, cword);
+    snprintf(funcname, sizeof(funcname), "%.*s", cwordlen, cword);
     have_funcname = TRUE;
-    if (curfuncs[0] == '\0')
-        strcpy(curfuncs, funcname);
-    else if (strlen(curfuncs) < 80) {
-        strcat(curfuncs, "  ");
-        strcat(curfuncs, funcname);
-
-    }
 }
 
 
 /*
  * the last word was not a keyword, check if it was a function
  */
-void WasNotKeyword() {
+void Renderer::WasNotKeyword() {
     if (func_depth == 0 && seen_directive == FALSE) {
-        strcpy(tmpbuffer, ibuffer);
-        if (IsItAFunc(FALSE, ibuffp, 0, FALSE, 0))
+        open_parens.clear();
+        scan_rescanned = FALSE;
+        if (IsItAFunc(ibuffer, FALSE, ibuffp, 0, FALSE, 0))
             WasAFunc();
     }
     PutWordInBuffer();
 }
 
 
-/*
- * append the current input character to the current word buffer
- */
-void PutCharInWord() {
-    cword[cwordp++] = ibuffer[ibuffp];
-    cword[cwordp] = '\0';
-}
-
-
 /*
  * process the file in comment mode
  */
-void InComMode() {
-    switch (ibuffer[ibuffp]) {
-        case '*':
-            if (comment_style == COMMENT_END_STAR_SLASH) {
-                if (ibuffer[ibuffp + 1] == '/') {
-                    WhatToPutIn(ibuffer[ibuffp++]);
-                    WhatToPutIn(ibuffer[ibuffp]);
-                    WriteBuffer();
-                    WriteFont(1);
-                    comment_style = 0;
-                } else
-                    WhatToPutIn(ibuffer[ibuffp]);
-            } else
-                WhatToPutIn(ibuffer[ibuffp]);
-            break;
+void Renderer::InComMode() {
+    char c = ibuffer[ibuffp];
+
+    switch (c) {
         case '\f':
         case '\r':
         case '\n':
@@ -1510,7 +2618,20 @@ void InComMode() {
                 ypos = 0;
             break;
         default:
-            WhatToPutIn(ibuffer[ibuffp]);
+            if (comment_style != COMMENT_END_STAR_SLASH) {
+                PutRun('\n', '\n');
+            } else if (c != comment_close[0]) {
+                /* only comment_close can end the comment before the line does */
+                PutRun(comment_close[0], comment_close[0]);
+            } else if (comment_close[1] == '\0' || ibuffer[ibuffp + 1] == comment_close[1]) {
+                if (comment_close[1] != '\0')
+                    WhatToPutIn(ibuffer[ibuffp++]);
+                WhatToPutIn(ibuffer[ibuffp]);
+                WriteBuffer();
+                WriteFont(1);
+                comment_style = 0;
+            } else
+                WhatToPutIn(c);
             break;
     }
 }
@@ -1519,7 +2640,7 @@ void InComMode() {
 /*
  * enter comment mode
  */
-void StartComMode(int style, int is_two_char) {
+void Renderer::StartComMode(int style, int is_two_char) {
     comment_style = style;
     WriteBuffer();
     WriteFont(4);
@@ -1531,41 +2652,73 @@ void StartComMode(int style, int is_two_char) {
 
 
 /*
- * process the file in file mode
+ * process a line in file mode (-text).  Only tabs, the characters that
+ * need escaping and the ones that end a line have to be looked at one by
+ * one; the runs between them are found with ScanTextSpecial() and copied
+ * whole, cut where the line wraps or a show string is full.
  */
-void InFileMode() {
-    switch (ibuffer[ibuffp]) {
-        case '\f':
-        case '\r':
-        case '\n':
-        case '\0':
-            if (obuffp > 0)
-                WriteBuffer();
-            moreonline = FALSE;
-            if (ibuffer[ibuffp] == '\f')
-                ypos = 0;
-            break;
-        default:
-            if (x >= wrap_col) {
-                WhatToPutIn('\\');
+void Renderer::InFileLine() {
+    const char *p = ibuffer,
+            *end = ibuffer + input.LineLength(),
+            *run;
+    size_t k;
+    char c;
+
+    for (;;) {
+        run = p;
+        p = ScanTextSpecial(p, end);
+        while (run < p) {
+            if (x >= wrap_col)
+                WrapLine();
+            if (obuffp >= MAXSHOWLEN)
                 WriteBuffer();
-                ypos -= LINEWIDTH;
-                if (ypos < BOTTOM) {
-                    PrintPage();
-                    MakeNewPage();
-                    ypos = top;
-                }
-                fprintf(outfile, "%d %d m ", LMARG, ypos);
-                x = 0;
-            }
-            WhatToPutIn(ibuffer[ibuffp]);
+            k = std::min({(size_t) (p - run), (size_t) (wrap_col - x), (size_t) (MAXSHOWLEN - obuffp)});
+            memcpy(obuffer + obuffp, run, k);
+            obuffp += k;
+            x += k;
+            run += k;
+        }
+        c = (p < end) ? *p : '\0';    /* an unterminated last line ends in a NUL */
+        switch (c) {
+            case '\f':
+            case '\r':
+            case '\n':
+            case '\0':
+                if (obuffp > 0)
+                    WriteBuffer();
+                if (c == '\f')
+                    ypos = 0;
+                return;
+            default:
+                if (x >= wrap_col)
+                    WrapLine();
+                WhatToPutIn(c);
+                p++;
+        }
+    }
+}
+
+
+/*
+ * the line has reached wrap_col: mark it and carry on at the next line
+ */
+void Renderer::WrapLine() {
+    WhatToPutIn('\\');
+    WriteBuffer();
+    ypos -= LINEWIDTH;
+    if (ypos < BOTTOM) {
+        PrintPage();
+        MakeNewPage();
+        ypos = top;
     }
+    MoveToLine();
+    x = 0;
 }
 
 /*
  * enter text mode
  */
-void StopTxtMode() {
+void Renderer::StopTxtMode() {
     WhatToPutIn(ibuffer[ibuffp]);
     WriteBuffer();
     WriteFont(1);
@@ -1576,7 +2729,7 @@ void StopTxtMode() {
 /*
  * process the file in text mode
  */
-void InTxtMode() {
+void Renderer::InTxtMode() {
     switch (ibuffer[ibuffp]) {
         case '\'':
         case '\"':
@@ -1602,7 +2755,10 @@ void InTxtMode() {
                 lastwasbslash = TRUE;
             else
                 lastwasbslash = FALSE;
-            WhatToPutIn(ibuffer[ibuffp]);
+            if (ibuffer[ibuffp] == '\\')
+                WhatToPutIn(ibuffer[ibuffp]);
+            else    /* no backslash in a run, so lastwasbslash stays FALSE */
+                PutRun(txtchar, '\\');
     }
 }
 
@@ -1610,7 +2766,7 @@ void InTxtMode() {
 /*
  * enter text mode
  */
-void StartTxtMode() {
+void Renderer::StartTxtMode() {
     txtchar = ibuffer[ibuffp];
     txtmode = TRUE;
     WriteBuffer();
@@ -1621,14 +2777,958 @@ void StartTxtMode() {
 
 
 /*
- * parse the input file
+ * start writing to fd, or to memory if fd is -1
  */
-void ParseFile() {
-    int is_word_char;
+void PsWriter::Open(int fd_p, const char *name_p) {
+    struct stat statb;
 
-    pageno = 0;
+    fd = fd_p;
+    name = name_p;
+    size = WRITE_BLOCK;
+    len = flushed = 0;
+    buf = (char *) malloc(size);
+#ifdef F_SETPIPE_SZ
+    /* let each write() hand a whole buffer to ps2pdf or lpr */
+    if (fd >= 0 && fstat(fd, &statb) == 0 && S_ISFIFO(statb.st_mode))
+        fcntl(fd, F_SETPIPE_SZ, WRITE_BLOCK);
+#endif
+}
+
+
+void PsWriter::Close() {
+    Flush();
+    if (fd >= 0)
+        close(fd);
+    fd = -1;
+    free(buf);
+    buf = NULL;
+    len = size = 0;
+}
+
+
+void PsWriter::Flush() {
+    if (fd >= 0 && len > 0) {
+        WriteOut(buf, len);
+        len = 0;
+    }
+}
+
+
+/*
+ * make room for n more bytes: flush to the file, or grow a memory buffer
+ */
+void PsWriter::MakeRoom(size_t n) {
+    if (fd >= 0) {
+        Flush();
+    } else {
+        while (size - len < n)
+            size *= 2;
+        buf = (char *) realloc(buf, size);
+    }
+}
+
+
+void PsWriter::WriteOut(const char *s, size_t n) {
+    ssize_t done;
+
+    while (n > 0) {
+        done = write(fd, s, n);
+        if (done < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "%s: can't write '%s' %s\n", argv0, name, strerror(errno));
+            exit(1);
+        }
+        s += done;
+        n -= done;
+        flushed += done;
+    }
+}
+
+
+void PsWriter::Printf(const char *fmt, ...) {
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(buf + len, size - len, fmt, ap);
+    va_end(ap);
+    if (n >= 0 && (size_t) n >= size - len) {
+        MakeRoom(n + 1);
+        va_start(ap, fmt);
+        n = vsnprintf(buf + len, size - len, fmt, ap);
+        va_end(ap);
+    }
+    if (n > 0)
+        len += n;
+}
+
+
+/*
+ * write page body s (n bytes long) to out_p, compressed with method
+ */
+void PageEncoder::Encode(PsWriter &out_p, int method, const char *s, size_t n) {
+    out = &out_p;
+    bitbuf = nbits = group = ngroup = col = 0;
+    out->Lit("Z\n");
+    if (method == COMPRESS_FLATE)
+        Flate(s, n);
+    else
+        Lzw(s, n);
+
+    /* a final partial group is padded with zeros and cut to ngroup + 1 */
+    if (ngroup > 0) {
+        char digits[5];
+        unsigned v = group << (8 * (4 - ngroup)),
+                k;
+
+        for (k = 5; k-- > 0; v /= 85)
+            digits[k] = (char) ('!' + v % 85);
+        PutA85(digits, ngroup + 1);
+    }
+    out->Lit("~>\n");
+}
+
+
+void PageEncoder::Lzw(const char *s, size_t n) {
+    unsigned prefix,
+            k,
+            h;
+    size_t i;
+
+    ClearTable();
+    PutCode(LZW_CLEAR);
+    if (n > 0) {
+        prefix = (unsigned char) s[0];
+        for (i = 1; i < n; i++) {
+            k = (prefix << 8 | (unsigned char) s[i]) + 1;
+            for (h = (k * 0x9E3779B1u) >> 19; key[h] != 0; h = (h + 1) & (LZW_HASH - 1))
+                if (key[h] == k)
+                    break;
+            if (key[h] == k) {
+                prefix = code[h];
+                continue;
+            }
+            PutCode(prefix);
+            key[h] = k;
+            code[h] = next_code++;
+            if (next_code > LZW_LAST) {
+                PutCode(LZW_CLEAR);
+                ClearTable();
+            }
+            prefix = (unsigned char) s[i];
+        }
+        PutCode(prefix);
+    }
+    next_code++;            /* the decoder adds an entry after the last code */
+    PutCode(LZW_EOD);
+    if (nbits > 0)
+        PutByte((unsigned char) (bitbuf << (8 - nbits)));
+}
+
+
+void PageEncoder::ClearTable() {
+    memset(key, 0, sizeof(key));
+    next_code = LZW_FIRST;
+}
+
+
+/*
+ * pack code into the bit stream at the width the decoder will be using,
+ * which has to look at next_code before it is bumped for this code
+ */
+void PageEncoder::PutCode(unsigned c) {
+    unsigned width = next_code < 512 ? 9 : next_code < 1024 ? 10 : next_code < 2048 ? 11 : 12;
+    bitbuf = bitbuf << width | c;
+    nbits += width;
+    while (nbits >= 8) {
+        nbits -= 8;
+        PutByte((unsigned char) (bitbuf >> nbits));
+    }
+    bitbuf &= (1u << nbits) - 1;
+}
+
+
+static const unsigned short flate_len_base[29] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const unsigned char flate_len_extra[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const unsigned short flate_dist_base[30] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const unsigned char flate_dist_extra[30] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+static const unsigned char flate_clen_order[19] = {
+        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+#define FlateHash(p) ((((unsigned char) (p)[0] << 10) ^ ((unsigned char) (p)[1] << 5) ^ \
+                       (unsigned char) (p)[2]) & (FLATE_HASH - 1))
+
+/*
+ * Huffman code lengths, at most limit bits, for the n symbols counted in
+ * freq.  At least two symbols get a code so every tree is complete.  If
+ * the tree comes out too deep the counts are flattened and it is rebuilt.
+ */
+static void FlateLengths(const unsigned *freq_p, int n, unsigned limit, unsigned char *lens) {
+    unsigned freq[286],
+            weight[2 * 286];
+    int parent[2 * 286],
+            nodes,
+            used,
+            k;
+    unsigned depth,
+            max;
+
+    for (k = 0, used = 0; k < n; k++) {
+        freq[k] = freq_p[k];
+        used += freq[k] != 0;
+    }
+    for (k = 0; used < 2; k++)
+        if (freq[k] == 0) {
+            freq[k] = 1;
+            used++;
+        }
+    for (;;) {
+        /* queue of (weight, node) with the lightest on top */
+        std::vector<std::pair<unsigned, int>> heap;
+
+        for (k = 0; k < n; k++)
+            if (freq[k] != 0) {
+                weight[k] = freq[k];
+                heap.push_back(std::make_pair(freq[k], k));
+            }
+        std::make_heap(heap.begin(), heap.end(), std::greater<std::pair<unsigned, int>>());
+        for (nodes = n; heap.size() > 1; nodes++) {
+            std::pop_heap(heap.begin(), heap.end(), std::greater<std::pair<unsigned, int>>());
+            std::pair<unsigned, int> a = heap.back();
+            heap.pop_back();
+            std::pop_heap(heap.begin(), heap.end(), std::greater<std::pair<unsigned, int>>());
+            std::pair<unsigned, int> b = heap.back();
+            heap.pop_back();
+            parent[a.second] = parent[b.second] = nodes;
+            weight[nodes] = a.first + b.first;
+            heap.push_back(std::make_pair(weight[nodes], nodes));
+            std::push_heap(heap.begin(), heap.end(), std::greater<std::pair<unsigned, int>>());
+        }
+        parent[nodes - 1] = -1;
+        max = 0;
+        for (k = 0; k < n; k++) {
+            lens[k] = 0;
+            if (freq[k] == 0)
+                continue;
+            for (depth = 0, used = k; parent[used] >= 0; used = parent[used])
+                depth++;
+            lens[k] = (unsigned char) depth;
+            if (depth > max)
+                max = depth;
+        }
+        if (max <= limit)
+            return;
+        for (k = 0; k < n; k++)
+            if (freq[k] != 0)
+                freq[k] = (freq[k] >> 1) | 1;
+    }
+}
+
+
+/*
+ * canonical codes for lens, bit reversed since deflate sends codes
+ * starting with their most significant bit
+ */
+static void FlateCodes(const unsigned char *lens, int n, unsigned short *codes) {
+    unsigned count[16] = {0},
+            next[16],
+            c = 0,
+            r,
+            b;
+    int k;
+
+    for (k = 0; k < n; k++)
+        count[lens[k]]++;
+    count[0] = 0;
+    for (b = 1; b < 16; b++) {
+        c = (c + count[b - 1]) << 1;
+        next[b] = c;
+    }
+    for (k = 0; k < n; k++) {
+        if (lens[k] == 0)
+            continue;
+        c = next[lens[k]]++;
+        for (r = 0, b = 0; b < lens[k]; b++, c >>= 1)
+            r = r << 1 | (c & 1);
+        codes[k] = (unsigned short) r;
+    }
+}
+
+
+/*
+ * the longest earlier match for s[i], at most FLATE_CHAIN candidates back
+ */
+unsigned PageEncoder::FindMatch(const char *s, size_t n, size_t i, unsigned *dist) {
+    long here = origin + (long) i,
+            cand,
+            next;
+    unsigned best = 0,
+            max = n - i < 258 ? (unsigned) (n - i) : 258,
+            len,
+            chain = FLATE_CHAIN;
+    const char *p = s + i,
+            *q;
+
+    if (max < 3)
+        return 0;
+    for (cand = head[FlateHash(p)];
+         cand >= origin && here - cand <= FLATE_WINDOW && chain-- > 0; cand = next) {
+        q = s + (cand - origin);
+        if (q[best] == p[best] && q[0] == p[0] && q[1] == p[1]) {
+            for (len = 2; len < max && q[len] == p[len]; len++)
+                ;
+            if (len > best) {
+                best = len;
+                *dist = (unsigned) (here - cand);
+                if (len == max)
+                    break;
+            }
+        }
+        next = prev[cand & (FLATE_WINDOW - 1)];
+        if (next >= cand)
+            break;
+    }
+    return best >= 3 ? best : 0;
+}
+
+
+/*
+ * deflate s (n bytes) into a zlib stream: one block with its own
+ * Huffman codes, since a page is never much bigger than the window
+ */
+void PageEncoder::Flate(const char *s, size_t n) {
+    unsigned len,
+            len2,
+            dist,
+            dist2,
+            a = 1,
+            b = 0;
+    size_t i,
+            k;
+
+#define FLATE_INSERT(at) do { \
+        if ((at) + 2 < n) { \
+            unsigned h_ = FlateHash(s + (at)); \
+            prev[(origin + (at)) & (FLATE_WINDOW - 1)] = head[h_]; \
+            head[h_] = origin + (at); \
+        } } while (0)
+
+    if (!head_ready) {
+        for (k = 0; k < FLATE_HASH; k++)
+            head[k] = -1;
+        head_ready = true;
+    }
+    tokens.clear();
+    for (i = 0; i < n;) {
+        len = FindMatch(s, n, i, &dist);
+        FLATE_INSERT(i);
+        if (len >= 3 && len < FLATE_LAZY && i + 1 < n) {
+            len2 = FindMatch(s, n, i + 1, &dist2);
+            if (len2 > len) {
+                tokens.push_back((unsigned char) s[i]);
+                i++;
+                FLATE_INSERT(i);
+                len = len2;
+                dist = dist2;
+            }
+        }
+        if (len >= 3) {
+            tokens.push_back(FLATE_MATCH | len << 16 | dist);
+            for (k = 1; k < len; k++)
+                FLATE_INSERT(i + k);
+            i += len;
+        } else {
+            tokens.push_back((unsigned char) s[i]);
+            i++;
+        }
+    }
+#undef FLATE_INSERT
+    /* nothing in head or prev may point into this page once it is gone */
+    origin += (long) n + FLATE_WINDOW;
+
+    PutByte(0x78);          /* deflate, 32K window */
+    PutByte(0x9C);
+    FlateBlock();
+    if (nbits > 0)
+        PutBits(0, 8 - nbits);
+
+    for (i = 0; i < n;) {
+        for (k = i + 5552 < n ? i + 5552 : n; i < k; i++) {
+            a += (unsigned char) s[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    PutByte((unsigned char) (b >> 8));
+    PutByte((unsigned char) b);
+    PutByte((unsigned char) (a >> 8));
+    PutByte((unsigned char) a);
+}
+
+
+/*
+ * write tokens as the final deflate block, with dynamic Huffman codes
+ */
+void PageEncoder::FlateBlock() {
+    unsigned lit_freq[286] = {0},
+            dist_freq[30] = {0},
+            clen_freq[19] = {0},
+            rle[286 + 30],
+            nrle = 0,
+            t,
+            c,
+            d,
+            run;
+    unsigned char lens[286 + 30],
+            clen_lens[19];
+    unsigned short lit_codes[286],
+            dist_codes[30],
+            clen_codes[19];
+    int nlit,
+            ndist,
+            nclen,
+            k,
+            j;
+
+    for (unsigned tok : tokens) {
+        if (tok & FLATE_MATCH) {
+            for (c = 28; flate_len_base[c] > (tok >> 16 & 0x1ff); c--)
+                ;
+            lit_freq[257 + c]++;
+            for (d = 29; flate_dist_base[d] > (tok & 0xffff); d--)
+                ;
+            dist_freq[d]++;
+        } else
+            lit_freq[tok]++;
+    }
+    lit_freq[256] = 1;
+    FlateLengths(lit_freq, 286, 15, lens);
+    FlateLengths(dist_freq, 30, 15, lens + 286);
+    FlateCodes(lens, 286, lit_codes);
+    FlateCodes(lens + 286, 30, dist_codes);
+    for (nlit = 286; nlit > 257 && lens[nlit - 1] == 0; nlit--)
+        ;
+    for (ndist = 30; ndist > 1 && lens[286 + ndist - 1] == 0; ndist--)
+        ;
+
+    /* run length code the lengths, as 0-15, 16 (repeat), 17/18 (zeros) */
+    memmove(lens + nlit, lens + 286, ndist);
+    for (k = 0; k < nlit + ndist; k += run) {
+        for (run = 1; k + run < (unsigned) (nlit + ndist) && lens[k + run] == lens[k]; run++)
+            ;
+        if (lens[k] == 0 && run >= 3) {
+            run = run > 138 ? 138 : run;
+            rle[nrle++] = run >= 11 ? 18 | (run - 11) << 8 : 17 | (run - 3) << 8;
+        } else if (lens[k] != 0 && run >= 4) {
+            run = run > 7 ? 7 : run;
+            rle[nrle++] = lens[k];
+            rle[nrle++] = 16 | (run - 4) << 8;
+        } else {
+            run = 1;
+            rle[nrle++] = lens[k];
+        }
+    }
+    for (t = 0; t < nrle; t++)
+        clen_freq[rle[t] & 0xff]++;
+    FlateLengths(clen_freq, 19, 7, clen_lens);
+    FlateCodes(clen_lens, 19, clen_codes);
+    for (nclen = 19; nclen > 4 && clen_lens[flate_clen_order[nclen - 1]] == 0; nclen--)
+        ;
+
+    PutBits(1, 1);          /* last block */
+    PutBits(2, 2);          /* dynamic Huffman codes */
+    PutBits(nlit - 257, 5);
+    PutBits(ndist - 1, 5);
+    PutBits(nclen - 4, 4);
+    for (j = 0; j < nclen; j++)
+        PutBits(clen_lens[flate_clen_order[j]], 3);
+    for (t = 0; t < nrle; t++) {
+        c = rle[t] & 0xff;
+        PutBits(clen_codes[c], clen_lens[c]);
+        if (c == 16)
+            PutBits(rle[t] >> 8, 2);
+        else if (c == 17)
+            PutBits(rle[t] >> 8, 3);
+        else if (c == 18)
+            PutBits(rle[t] >> 8, 7);
+    }
+
+    for (unsigned tok : tokens) {
+        if (tok & FLATE_MATCH) {
+            unsigned len = tok >> 16 & 0x1ff,
+                    dist = tok & 0xffff;
+
+            for (c = 28; flate_len_base[c] > len; c--)
+                ;
+            PutBits(lit_codes[257 + c], lens[257 + c]);
+            PutBits(len - flate_len_base[c], flate_len_extra[c]);
+            for (d = 29; flate_dist_base[d] > dist; d--)
+                ;
+            PutBits(dist_codes[d], lens[nlit + d]);
+            PutBits(dist - flate_dist_base[d], flate_dist_extra[d]);
+        } else
+            PutBits(lit_codes[tok], lens[tok]);
+    }
+    PutBits(lit_codes[256], lens[256]);
+}
+
+
+/*
+ * add n bits to the deflate stream, least significant first
+ */
+void PageEncoder::PutBits(unsigned v, unsigned n) {
+    bitbuf |= (unsigned long long) v << nbits;
+    nbits += n;
+    while (nbits >= 8) {
+        PutByte((unsigned char) bitbuf);
+        bitbuf >>= 8;
+        nbits -= 8;
+    }
+}
+
+
+void PageEncoder::PutByte(unsigned char c) {
+    char digits[5];
+    unsigned v;
+    int k;
+
+    group = group << 8 | c;
+    if (++ngroup < 4)
+        return;
+    v = group;
+    group = ngroup = 0;
+    if (v == 0) {
+        PutA85("z", 1);
+        return;
+    }
+    for (k = 5; k-- > 0; v /= 85)
+        digits[k] = (char) ('!' + v % 85);
+    PutA85(digits, 5);
+}
+
+
+/*
+ * add ASCII85 characters to the output, in lines that never start with
+ * a % so nothing in them looks like a DSC comment
+ */
+void PageEncoder::PutA85(const char *s, int n) {
+    for (; n > 0; n--, s++) {
+        if (col == 0 && *s == '%')
+            out->Char(' ');
+        out->Char(*s);
+        if (++col == A85_LINE) {
+            out->Char('\n');
+            col = 0;
+        }
+    }
+}
+
+
+/*
+ * start reading fd: map it if it is a regular file, else read it in blocks
+ */
+void LineReader::Open(int fd_p) {
+    struct stat statb;
+
+    fd = fd_p;
+    error = 0;
+    nlines = 0;
+    at_eof = false;
+    dropped = 0;
+    if (fstat(fd, &statb) == 0 && S_ISREG(statb.st_mode) && statb.st_size > 0) {
+        /*
+         * the rest of the file's last page reads as zeros, and if the file
+         * fills that page the zero page reserved after it is there instead
+         */
+        size_t page = sysconf(_SC_PAGESIZE);
+
+        size = (statb.st_size / page + 1) * page;
+        data = (char *) mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data != MAP_FAILED) {
+            if (mmap(data, statb.st_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) != MAP_FAILED) {
+                mapped = true;
+                at_eof = true;
+                len = statb.st_size;
+                madvise(data, len, MADV_SEQUENTIAL);
+                return;
+            }
+            munmap(data, size);
+        }
+    }
+    mapped = false;
+    size = READ_BLOCK;
+    len = 0;
+    data = (char *) malloc(size + 1);
+    data[0] = '\0';
+}
+
+
+void LineReader::Close() {
+    if (data != NULL) {
+        if (mapped)
+            munmap(data, size);
+        else
+            free(data);
+    }
+    for (char *old : retired)
+        free(old);
+    retired.clear();
+    data = NULL;
+    len = size = 0;
+    nlines = 0;
+}
+
+
+/*
+ * read another block into the buffer, growing it if it is full
+ */
+void LineReader::Fill() {
+    ssize_t n;
+
+    if (len == size) {
+        char *bigger = (char *) malloc(2 * size + 1);
+
+        memcpy(bigger, data, len);
+        retired.push_back(data);
+        data = bigger;
+        size *= 2;
+    }
+    do {
+        n = read(fd, data + len, size - len);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        if (n < 0)
+            error = errno;
+        at_eof = true;
+    } else {
+        len += n;
+    }
+    data[len] = '\0';
+}
+
+
+/*
+ * find the end of the line starting at start (just past its newline),
+ * reading more input as needed.  Returns false if there is no such line.
+ */
+bool LineReader::FindLine(size_t start, size_t *end) {
+    size_t from = start;
+
+    for (;;) {
+        const char *nl = (const char *) memchr(data + from, '\n', len - from);
+
+        if (nl != NULL) {
+            *end = nl - data + 1;
+            return true;
+        }
+        if (at_eof) {
+            *end = len;
+            return start < len;
+        }
+        from = len;
+        Fill();
+    }
+}
+
+
+/*
+ * advance to the next input line, taking it from the lookahead window
+ * if IsItAFunc() has already found it
+ */
+const char *LineReader::NextLine() {
+    size_t start = (nlines > 0) ? ends[0] : 0,
+            end;
+    int k;
+
+    for (char *old : retired)
+        free(old);
+    retired.clear();
+
+    if (nlines > 1) {
+        for (k = 1; k < nlines; k++) {
+            starts[k - 1] = starts[k];
+            ends[k - 1] = ends[k];
+        }
+        nlines--;
+    } else if (FindLine(start, &end)) {
+        starts[0] = start;
+        ends[0] = end;
+        nlines = 1;
+    } else {
+        nlines = 0;
+        return NULL;
+    }
+
+    start = starts[0];
+    if (mapped) {
+        /* nothing before the current line is looked at again */
+        if (start - dropped >= DROP_BEHIND) {
+            size_t upto = start & ~((size_t) sysconf(_SC_PAGESIZE) - 1);
+
+            madvise(data + dropped, upto - dropped, MADV_DONTNEED);
+            dropped = upto;
+        }
+    } else if (start > size / 2) {
+        /* slide the unread part of the buffer down */
+        memmove(data, data + start, len - start + 1);
+        len -= start;
+        for (k = 0; k < nlines; k++) {
+            starts[k] -= start;
+            ends[k] -= start;
+        }
+    }
+    return data + starts[0];
+}
+
+
+/*
+ * return the line n lines past the current one (n >= 1), finding it in
+ * the input if need be.  Returns NULL at end of file.
+ */
+const char *LineReader::PeekLine(int n) {
+    size_t end;
+
+    if (n > LOOKAHEAD_LINES || nlines == 0)
+        return NULL;
+    while (nlines <= n) {
+        if (!FindLine(ends[nlines - 1], &end))
+            return NULL;
+        starts[nlines] = ends[nlines - 1];
+        ends[nlines] = end;
+        nlines++;
+    }
+    return data + starts[n];
+}
+
+
+/*
+ * list the current line (not -text), from the start or from where a
+ * string or comment carried over from the line before
+ */
+template<int LANG>
+void Renderer::LexLine() {
+    const lex_table_t &lex = (LANG == LANG_DEFINED) ? lang_def->image->lex : lex_tables[LANG];
+    const bool c_like = (LANG == LANG_C || LANG == LANG_CPP) ||
+                        (LANG == LANG_DEFINED && lang_def->image->directive != 0);
+    int n,
+            k;
+    char c;
+
+    for (cwordp = ibuffp = obuffp = x = 0, moreonline = TRUE;
+         moreonline; ibuffp++) {
+
+        if (txtmode) {              /* we are printing text */
+            InTxtMode();
+            continue;
+        }
+        if (comment_style != 0) {   /* we are printing comments */
+            InComMode();
+            continue;
+        }
+
+        c = ibuffer[ibuffp];
+        switch (lex.cls[(unsigned char) c]) {
+            case LX_WORD:
+                /*
+                 * gather the characters of the current word, as many as
+                 * there are
+                 */
+                for (n = 1; lex.cls[(unsigned char) ibuffer[ibuffp + n]] == LX_WORD; n++)
+                    ;
+                if (cwordp == 0)
+                    cword = &ibuffer[ibuffp];
+                else if (cword + cwordp != &ibuffer[ibuffp]) {
+                    /*
+                     * a quote came in the middle of the word (1'000, u8"a"b):
+                     * the literal is shown on its own and the word goes on
+                     * after it, so gather the pieces in cword_split
+                     */
+                    if (cword != cword_split.data())
+                        cword_split.assign(cword, cwordp);
+                    cword_split.append(&ibuffer[ibuffp], n);
+                    cword = cword_split.data();
+                }
+                cwordlen = cwordp += n;
+                ibuffp += n - 1;
+                seen_non_blank = TRUE;
+                break;
+
+            case LX_END:
+                if (ibuffp > 0) {
+                    if (cwordp > 0) {
+                        if (IsKeyword<LANG>(cword, cwordp, NULL))
+                            WasKeyword();
+                        else
+                            WasNotKeyword();
+                        WhatToPutIn(c);
+                    }
+                }
+                moreonline = FALSE;
+                if (c == '\f') {
+                    ypos = 0;
+                }
+                /*
+                 * handle C style continuation lines (\newline)
+                 */
+                if (c_like && !(ibuffp > 0 && c == '\n' && ibuffer[ibuffp - 1] == '\\')) {
+                    seen_directive = FALSE;
+                    seen_non_blank = FALSE;
+                }
+                break;
+
+            case LX_QUOTE:
+                seen_non_blank = TRUE;
+                StartTxtMode();
+                break;
+
+            case LX_BLANK:
+            case LX_PUNCT:
+                /*
+                 * blanks and punctuation are only shown: put the run of
+                 * them in the buffer in one go
+                 */
+                EndWord<LANG>();
+                for (n = 0; (k = lex.cls[(unsigned char) ibuffer[ibuffp + n]]) == LX_BLANK ||
+                            k == LX_PUNCT; n++)
+                    if (k == LX_PUNCT)
+                        seen_non_blank = TRUE;
+                if (n == 1)
+                    WhatToPutIn(c);
+                else
+                    PutText(&ibuffer[ibuffp], &ibuffer[ibuffp + n], '\n', '\n');
+                ibuffp += n - 1;
+                break;
+
+            case LX_COMMENT:
+                seen_non_blank = TRUE;
+                EndWord<LANG>();
+                if (LANG == LANG_TRELLIS)
+                    StartComMode(COMMENT_END_NEWLINE, FALSE);
+                else if (LANG == LANG_DEFINED) {
+                    if ((n = Opens(&ibuffer[ibuffp], lang_def->image->block_open)) > 0)
+                        StartComMode(COMMENT_END_STAR_SLASH, n == 2);
+                    else if ((n = Opens(&ibuffer[ibuffp], lang_def->image->line_comment)) > 0)
+                        StartComMode(COMMENT_END_NEWLINE, n == 2);
+                    else
+                        WhatToPutIn(c);
+                } else if (ibuffer[ibuffp + 1] == '*')
+                    StartComMode(COMMENT_END_STAR_SLASH, TRUE);
+                else if (ibuffer[ibuffp + 1] == '/')
+                    StartComMode(COMMENT_END_NEWLINE, TRUE);
+                else
+                    WhatToPutIn(c);
+                break;
+
+            case LX_DIRECTIVE:
+                if (seen_non_blank == TRUE || ibuffp == 0)
+                    seen_directive = TRUE;
+                goto punct;
+
+            case LX_BRACE_OPEN:
+                func_depth++;
+                goto punct;
+
+            case LX_BRACE_CLOSE:
+                func_depth--;
+                goto punct;
+
+            case LX_BRACKET_OPEN:
+                square_bracket_depth++;
+                goto punct;
+
+            case LX_BRACKET_CLOSE:
+                square_bracket_depth--;
+                goto punct;
+
+            case LX_PAREN_OPEN:
+                paren_depth++;
+                goto punct;
+
+            case LX_PAREN_CLOSE:
+                paren_depth--;
+                goto punct;
+
+            default:
+            punct:
+                seen_non_blank = TRUE;
+                EndWord<LANG>();
+                WhatToPutIn(c);
+                break;
+        }
+    }
+}
+
+
+/*
+ * a character that can't be part of a word: finish the current word,
+ * if any
+ */
+template<int LANG>
+void Renderer::EndWord() {
+    int offset;
+
+    if (cwordp == 0)
+        return;
+    if (IsKeyword<LANG>(cword, cwordp, &offset)) {
+        WasKeyword();
+        /*
+         * manage function depth for languages that use begin / end pairs
+         */
+        if (offset != 0) {
+            func_depth += offset;
+            if ((LANG == LANG_VERILOG || (LANG == LANG_DEFINED && lang_def->image->named_blocks)) &&
+                (offset > 0))
+                func_name_search = 1;
+        }
+    } else {
+        WasNotKeyword();
+        if ((LANG == LANG_VERILOG || LANG == LANG_DEFINED) && (func_name_search == 1)) {
+            if (square_bracket_depth == 0) {
+                WasAFunc();
+                func_name_search = 0;
+            }
+        }
+    }
+}
+
+
+/*
+ * parse the input file
+ */
+void Renderer::ParseFile() {
+    static void (Renderer::*const lex_lines[])() = {
+            &Renderer::LexLine<LANG_CPP>,      /* no language: never used */
+            &Renderer::LexLine<LANG_C>,
+            &Renderer::LexLine<LANG_TRELLIS>,
+            &Renderer::LexLine<LANG_CPP>,
+            &Renderer::LexLine<LANG_VERILOG>,
+            &Renderer::LexLine<LANG_VERA>,
+            &Renderer::LexLine<LANG_DEFINED>};
+    void (Renderer::*lex_line)() = lex_lines[language];
+
+    comment_close = (language == LANG_DEFINED) ? lang_def->image->block_close : "*/";
+
+    pageno = 0;
     lineno = 1;
+    for (ParenMatches &pm : paren_matches) {
+        pm.line = 0;
+        pm.close.clear();
+    }
     func_depth = 0;
+    paren_depth = 0;
+    square_bracket_depth = 0;
+    func_name_search = 0;
+    funcname[0] = '\0';
     txtmode = FALSE;
     txtchar = ' ';
     moreonline = TRUE;
@@ -1637,8 +3737,12 @@ void ParseFile() {
     have_funcname = FALSE;
     seen_directive = FALSE;
     seen_non_blank = FALSE;
+    top_of_page = FALSE;
+    ypos = top;
+    cwordlen = 0;
+    input.Open(fileno(infile));
 
-    while (fgets(ibuffer, MAXCHARSINLINE, infile) != NULL) {
+    while ((ibuffer = input.NextLine()) != NULL) {
 
         /* check if this line is empty or not */
         if (ibuffer[0] != '\n') {   /* not empty line */
@@ -1655,225 +3759,16 @@ void ParseFile() {
             }
 
             /* move to the right position */
-            fprintf(outfile, "%d %d m ", LMARG, ypos);
+            MoveToLine();
         } else            /* empty line */
             moreonline = FALSE;
 
 
-        /* examine each charater if the line is not empty */
-        for (cwordp = ibuffp = obuffp = x = 0, moreonline = TRUE;
-             moreonline; ibuffp++) {
-
-            if (process_mode == 1)      /* processing a text file */
-                InFileMode();
-
-            else if (txtmode)           /* we are printing text */
-                InTxtMode();
-
-            else if (comment_style != 0)   /* we are printing comments */
-                InComMode();
-
-            else            /* other text */
-                switch (ibuffer[ibuffp]) {
-                    case '\n':
-                    case '\0':
-                    case '\r':
-                    case '\f':
-                        if (ibuffp > 0) {
-                            if (cwordp > 0) {
-                                if (IsKeyword(cword))
-                                    WasKeyword();
-                                else
-                                    WasNotKeyword();
-                                WhatToPutIn(ibuffer[ibuffp]);
-                            }
-                        }
-                        moreonline = FALSE;
-                        if (ibuffer[ibuffp] == '\f') {
-                            ypos = 0;
-                        }
-                        /*
-                         * check for continuation line
-                         */
-                        switch (language) {
-                            case LANG_C:
-                            case LANG_CPP:
-                                /*
-                                 * handle C style continuation lines (\newline)
-                                 */
-                                if (!(ibuffp > 0
-                                      && ibuffer[ibuffp] == '\n'
-                                      && ibuffer[ibuffp - 1] == '\\'
-                                )) {
-                                    seen_directive = FALSE;
-                                    seen_non_blank = FALSE;
-                                }
-                            case LANG_TRELLIS:
-                                /*
-                                 * handle trellis continuation lines (TBD)
-                                 */
-                                break;
-                            default:
-                                break;
-                        }
-                        break;
-
-                    case '\'':
-                        if (language == LANG_C || language == LANG_CPP) {
-                            seen_non_blank = TRUE;
-                            StartTxtMode();
-                        } else goto process_chars;
-                        break;
-
-                    case '\"':
-                        seen_non_blank = TRUE;
-                        StartTxtMode();
-                        break;
-
-                    case '#':
-                        if (language == LANG_C || language == LANG_CPP) {
-                            if (seen_non_blank == TRUE || ibuffp == 0)
-                                seen_directive = TRUE;
-                        }
-                        goto process_chars;
-                        break;
-
-                    case '{':
-                        if (language == LANG_C || language == LANG_CPP)
-                            func_depth++;
-                        goto process_chars;
-                        break;
-
-                    case '}':
-                        if (language == LANG_C || language == LANG_CPP)
-                            func_depth--;
-                        goto process_chars;
-                        break;
-
-                    case ']':
-                        if (language == LANG_VERILOG)
-                            square_bracket_depth--;
-                        goto process_chars;
-                        break;
-
-                    case '[':
-                        if (language == LANG_VERILOG)
-                            square_bracket_depth++;
-                        goto process_chars;
-                        break;
-
-                    case ')':
-                        if (language == LANG_VERILOG)
-                            paren_depth--;
-                        goto process_chars;
-                        break;
-                    case '(':
-                        if (language == LANG_VERILOG)
-                            paren_depth++;
-                        goto process_chars;
-                        break;
-
-                    default:
-                    process_chars:
-                        if (!isspace(ibuffer[ibuffp]))
-                            seen_non_blank = TRUE;
-
-                        /*
-                         * set is_word_char if the character is a legal
-                         * "word" character in the current language
-                         */
-                        switch (language) {
-                            case LANG_C:
-                                is_word_char = isalnum(ibuffer[ibuffp]) ||
-                                               ibuffer[ibuffp] == '_' ||
-                                               ibuffer[ibuffp] == '$';
-                                break;
-                            case LANG_CPP:
-                                is_word_char = isalnum(ibuffer[ibuffp]) ||
-                                               ibuffer[ibuffp] == '_' ||
-                                               ibuffer[ibuffp] == '$';
-                                break;
-                            case LANG_VERILOG:
-                            case LANG_VERA:
-                                is_word_char = isalnum(ibuffer[ibuffp]) ||
-                                               ibuffer[ibuffp] == '_' ||
-                                               ibuffer[ibuffp] == '$';
-                                break;
-                            case LANG_TRELLIS:
-                                is_word_char = isalnum(ibuffer[ibuffp]) ||
-                                               ibuffer[ibuffp] == '_' ||
-                                               ibuffer[ibuffp] == '#' ||
-                                               ibuffer[ibuffp] == '?';
-                                break;
-                        }
-
-                        if (is_word_char) {
-                            /*
-                             * gather characters of the current word
-                             */
-                            PutCharInWord();
-                        } else {
-                            /*
-                             * non-word character; finish the current word, if any
-                             */
-                            if (cwordp != 0) {
-                                if (IsKeyword(cword)) {
-                                    WasKeyword();
-                                    {
-                                        /*
-                                         * manage function depth for languages that use begin / end pairs
-                                         */
-                                        key_begin_end_t *ptr = func_start_end_array[language];
-                                        while (ptr->name != NULL) {
-                                            if (strcmp(cword, ptr->name) == 0) {
-                                                func_depth += ptr->offset;
-                                                if ((language == LANG_VERILOG) && (ptr->offset > 0)) {
-                                                    func_name_search = 1;
-                                                }
-                                                //printf("found %s, depth=%d search = %d\n", ptr->name, func_depth, func_name_search);
-                                                break;
-                                            }
-                                            ptr++;
-                                        }
-                                    }
-                                } else {
-                                    WasNotKeyword();
-                                    if ((language == LANG_VERILOG) &&
-                                        (func_name_search == 1)) {
-                                        if (square_bracket_depth == 0) {
-                                            WasAFunc();
-                                            func_name_search = 0;
-                                            //printf("searched %s, depth=%d search = %d\n", cword, func_depth, func_name_search);
-                                        }
-                                    }
-                                }
-                            }
-                            /*
-                             * check for start of a comment
-                             */
-                            switch (language) {
-
-                                case LANG_C:
-                                case LANG_CPP:
-                                case LANG_VERILOG:
-                                case LANG_VERA:
-                                    if (ibuffer[ibuffp] == '/' && ibuffer[ibuffp + 1] == '*')
-                                        StartComMode(COMMENT_END_STAR_SLASH, TRUE);
-                                    else if (ibuffer[ibuffp] == '/' && ibuffer[ibuffp + 1] == '/')
-                                        StartComMode(COMMENT_END_NEWLINE, TRUE);
-                                    else
-                                        WhatToPutIn(ibuffer[ibuffp]);
-                                    break;
-
-                                case LANG_TRELLIS:
-                                    if (ibuffer[ibuffp] == '!')
-                                        StartComMode(COMMENT_END_NEWLINE, FALSE);
-                                    else
-                                        WhatToPutIn(ibuffer[ibuffp]);
-                                    break;
-                            }
-                        }
-                }
+        if (process_mode == 1) {        /* processing a text file */
+            obuffp = x = 0;
+            InFileLine();
+        } else {
+            (this->*lex_line)();
         }
 
         /*
@@ -1885,17 +3780,21 @@ void ParseFile() {
          * we have a function on this line
          */
         if (have_funcname == TRUE) {
-            fprintf(outfile, "%d %d m ", rmarg, ypos);
             WriteFont(8);
-            fprintf(outfile, "(%s)rs ", funcname);
+            SelectFont();
+            RightX(funcname, rmarg, 8, BIGFSIZE);
+            out.Char(' ');
+            out.Int(ypos);
+            out.Lit(" m s ");
             //printf("function used %s %d->%d\n", funcname, have_funcname, FALSE);
             have_funcname = FALSE;
             WriteFont(0);
         }
         /*
          * put out the line number at the top of page and every 5 lines
+         * (blank lines ahead of the first page have nowhere to go)
          */
-        if (lineno % 5 == 0 || top_of_page == TRUE)
+        if (pageno != 0 && (lineno % 5 == 0 || top_of_page == TRUE))
             WriteLineNo(lineno);
 
         lineno++;
@@ -1903,6 +3802,10 @@ void ParseFile() {
         ypos -= LINEWIDTH;
     }
 
+    if (input.Error() != 0)
+        fprintf(stderr, "%s: on '%s' can't read: %s\n", argv0, ifname, strerror(input.Error()));
+    input.Close();
+
     if (pageno != 0)
         PrintPage();
 
@@ -1916,9 +3819,836 @@ void ParseFile() {
 
 
 /* Makes the PostScript Trailer */
-void MakeTrailer() {
-    fprintf(outfile, "%%%%Trailer\n");
-    fprintf(outfile, "%%%%Pages: %d\n", pagecount);
-    fclose(outfile);
-    if (infile != NULL) fclose(infile);
+void Renderer::MakeTrailer() {
+    if (index_name != NULL)
+        page_offsets.push_back(out.Tell());
+    out.Printf("%%%%Trailer\n");
+    out.Printf("%%%%Pages: %d\n", pagecount);
+    out.Close();
+    if (index_name != NULL)
+        WriteIndex();
+    if (shard > 0) {
+        /* so whatever reads our output can start on it */
+        printf("%s\n", doc_name);
+        fflush(stdout);
+    }
+}
+
+
+/*
+ * name, or with -shard-pages the name of shard k of it: "-k" (3 digits
+ * at least) goes before its suffix
+ */
+static void ShardName(char *to, size_t size, const char *name, int k, int shard_pages) {
+    const char *dot = strrchr(name, '.'),
+            *slash = strrchr(name, '/');
+
+    if (shard_pages == 0)
+        snprintf(to, size, "%s", name);
+    else if (dot == NULL || (slash != NULL && dot < slash))
+        snprintf(to, size, "%s-%03d", name, k);
+    else
+        snprintf(to, size, "%.*s-%03d%s", (int) (dot - name), name, k, dot);
+}
+
+
+/*
+ * open the output file, or the next shard of it with -shard-pages
+ */
+void Renderer::OpenDocument() {
+    int fd;
+
+    if ((strcmp(ofname, "-") == 0) || (strcmp(ofname, "-.ps") == 0)) {
+        if (shard_pages > 0) {
+            fprintf(stderr, "%s: can't write shards to standard output\n", argv0);
+            exit(1);
+        }
+        strcpy(doc_name, ofname);
+        out.Open(STDOUT_FILENO, "standard output");
+        return;
+    }
+    if (shard_pages > 0)
+        shard++;
+    ShardName(doc_name, sizeof(doc_name), ofname, shard, shard_pages);
+    if ((fd = open(doc_name, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
+#ifdef VMS
+        fprintf(stderr, "%s: can't open '%s'\n", argv0, doc_name);
+#else
+        fprintf(stderr, "%s: can't open '%s' %s\n", argv0, doc_name, strerror(errno));
+#endif
+        exit(1);
+    }
+    out.Open(fd, doc_name);
+}
+
+
+/*
+ * with -shard-pages, finish this shard and start the next before page
+ * pagecount when this one is full, keeping each a whole number of
+ * page_skip pages
+ */
+void Renderer::ShardBreak() {
+    if (shard_pages == 0 || pagecount <= shard_pages || (pagecount - 1) % page_skip != 0)
+        return;
+    pagecount--;
+    MakeTrailer();
+    pagecount = 1;
+    OpenDocument();
+    MakeProlog();
+}
+
+
+/*
+ * -index: write the byte offset of each page's %%Page comment and then of
+ * the %%Trailer, one to a line of INDEX_WIDTH characters (one index for
+ * each shard, named as the shards are).  Page k starts at the offset k - 1
+ * lines in and runs to the next one, and the prolog is everything before
+ * page 1, so a page range can be copied out with two seeks into the index
+ * and one into the document.
+ */
+void Renderer::WriteIndex() {
+    char name[MAXPATHLEN];
+    FILE *f;
+
+    ShardName(name, sizeof(name), index_name, shard, shard_pages);
+    if ((f = fopen(name, "w")) == NULL) {
+        fprintf(stderr, "%s: can't open '%s' %s\n", argv0, name, strerror(errno));
+        exit(1);
+    }
+    for (long long off : page_offsets)
+        fprintf(f, "%*lld\n", INDEX_WIDTH - 1, off);
+    if (fclose(f) != 0) {
+        fprintf(stderr, "%s: can't write '%s' %s\n", argv0, name, strerror(errno));
+        exit(1);
+    }
+    page_offsets.clear();
+}
+
+
+/*
+ * -dry-run: return how many pages ifname would take, going through the
+ * page layout alone
+ */
+int Renderer::DryRun() {
+    Paginator pages;
+    char *buf = (char *) malloc(READ_BLOCK);
+    ssize_t n;
+    int fd = 0,
+            count;
+
+    if (ifname[0] != '-' && (fd = open(ifname, O_RDONLY)) < 0) {
+        fprintf(stderr, "%s : can't open '%s' %s\n", argv0, ifname, strerror(errno));
+        exit(1);
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    pages.Start(top, wrap_col, process_mode == 1);
+    while ((n = read(fd, buf, READ_BLOCK)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "%s: on '%s' can't read: %s\n", argv0, ifname, strerror(errno));
+            break;
+        }
+        pages.Feed(buf, n);
+    }
+    if (fd != 0)
+        close(fd);
+    free(buf);
+    count = pages.Finish(page_skip);
+    pagecount += count;
+    return count;
+}
+
+
+/*
+ * take the page geometry from the Renderer producing the document
+ */
+void Renderer::CopyLayout(const Renderer &doc) {
+    urx = doc.urx;
+    ury = doc.ury;
+    top = doc.top;
+    topline = doc.topline;
+    rmarg = doc.rmarg;
+    wrap_col = doc.wrap_col;
+    todays_date = doc.todays_date;
+    prolog_bottom = doc.prolog_bottom;
+    ypos = top;
+}
+
+
+/*
+ * render ifname into frag rather than into the document
+ */
+void Renderer::RenderFragment(Fragment *frag) {
+    char key[CACHE_KEY_MAX];
+
+    key[0] = '\0';
+    if (ifname[0] == '-') {
+        infile = stdin;
+    } else if ((infile = fopen(ifname, "r")) == NULL) {
+        frag->error = errno;
+        return;
+    }
+    ResetTimbuf();
+    if (fragment_cache != NULL && infile != stdin) {
+        CacheKey(key, sizeof(key));
+        if (key[0] != '\0' && fragment_cache->Lookup(key, frag)) {
+            fclose(infile);
+            infile = NULL;
+            return;
+        }
+    }
+    out.Open(-1, ifname);
+    page_marks = &frag->pages;
+    pagecount = 0;
+    ParseFile();
+    frag->buf = out.Release(&frag->len);
+    page_marks = NULL;
+    if (key[0] != '\0')
+        fragment_cache->Store(key, *frag);
+    if (infile != stdin)
+        fclose(infile);
+    infile = NULL;
+}
+
+
+/*
+ * 64 bits of hash of n bytes at p; two seeds give a 128 bit hash
+ */
+static unsigned long long HashBytes(const void *p_p, size_t n, unsigned long long seed) {
+    const unsigned char *p = (const unsigned char *) p_p;
+    unsigned long long h = seed ^ (n * 0x9E3779B97F4A7C15ULL),
+            w;
+
+    for (; n >= 8; p += 8, n -= 8) {
+        memcpy(&w, p, 8);
+        w *= 0x87C37B91114253D5ULL;
+        w = w << 31 | w >> 33;
+        h = (h ^ (w * 0x4CF5AD432745937FULL)) * 0x9E3779B97F4A7C15ULL;
+        h = h << 27 | h >> 37;
+    }
+    for (w = 0; n > 0; n--)
+        w = w << 8 | p[n - 1];
+    h ^= w * 0x87C37B91114253D5ULL;
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    return h ^ (h >> 33);
+}
+
+
+/*
+ * the fragment cache key for infile rendered with these options, or ""
+ * if the file can't be read to hash it
+ */
+void Renderer::CacheKey(char *key, size_t size) {
+    struct stat statb;
+    void *map;
+    unsigned long long h0 = 0,
+            h1 = 0;
+    int n;
+
+    key[0] = '\0';
+    if (fstat(fileno(infile), &statb) != 0 || !S_ISREG(statb.st_mode))
+        return;
+    if (statb.st_size > 0) {
+        map = mmap(NULL, statb.st_size, PROT_READ, MAP_PRIVATE, fileno(infile), 0);
+        if (map == MAP_FAILED)
+            return;
+        h0 = HashBytes(map, statb.st_size, 1);
+        h1 = HashBytes(map, statb.st_size, 2);
+        munmap(map, statb.st_size);
+    }
+    n = snprintf(key, size, "%s\n%s\ncontent %lld %016llx%016llx\n"
+                        "language %d %016llx%016llx mode %d paper %d fixed %d rotate %d skip %d compact %d compress %d\n"
+                        "bottom %s\nprolog bottom %s\nheader %s\nfile %s\ndate %s\n",
+            rcs_ident, fragment_cache->build, (long long) statb.st_size, h0, h1,
+            language, (language == LANG_DEFINED) ? lang_def->image->source[0] : 0ULL,
+            (language == LANG_DEFINED) ? lang_def->image->source[1] : 0ULL, process_mode, paper_size, fixed_font, rotate_text, page_skip, compact, compress,
+            bottom_text != 0 ? bottom_text : "", prolog_bottom != 0 ? prolog_bottom : "",
+            header_string != 0 ? header_string : "",
+            ifname_full, timbuf);
+    if (n < 0 || (size_t) n >= size)
+        key[0] = '\0';     /* too long to keep whole, don't cache */
+}
+
+
+/*
+ * splice a rendered file into the document, numbering its pages
+ */
+void Renderer::WriteFragment(const Fragment &frag) {
+    size_t pos = 0;
+
+    for (long mark : frag.pages) {
+        out.Write(frag.buf + pos, mark - pos);
+        pagecount++;
+        ShardBreak();
+        if (index_name != NULL)
+            page_offsets.push_back(out.Tell());
+        out.Printf("%%%%Page: %d %d\n", pagecount, pagecount);
+        pos = mark;
+    }
+    out.Write(frag.buf + pos, frag.len - pos);
+}
+
+
+FragmentCache *fragment_cache = NULL;
+
+/*
+ * use dir for the cache, creating it if need be, and keep it to max_bytes_p
+ */
+void FragmentCache::Open(const char *dir_p, long long max_bytes_p) {
+    struct stat exe;
+
+    dir = dir_p;
+    max_bytes = max_bytes_p;
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST)
+        fprintf(stderr, "%s: can't create cache '%s' %s\n", argv0, dir, strerror(errno));
+    /* a rebuilt c2ps may render differently, so it gets fresh entries */
+    if (stat("/proc/self/exe", &exe) != 0)
+        memset(&exe, 0, sizeof(exe));
+    snprintf(build, sizeof(build), "build %lld %lld",
+            (long long) exe.st_size, (long long) exe.st_mtime);
+}
+
+
+void FragmentCache::EntryName(const char *key, char *name, size_t size) {
+    size_t n = strlen(key);
+
+    snprintf(name, size, "%s/%016llx%016llx.frag", dir, HashBytes(key, n, 3), HashBytes(key, n, 4));
+}
+
+
+/*
+ * Entries are
+ *     c2ps fragment <key length> <page count> <body length>\n
+ *     <key> <page offsets, as longs> <body>
+ */
+#define CACHE_MAGIC "c2ps fragment"
+
+/*
+ * fill in frag from the entry for key, if there is one
+ */
+bool FragmentCache::Lookup(const char *key, Fragment *frag) {
+    char name[MAXPATHLEN + 64],
+            head[128],
+            *p;
+    size_t keylen,
+            npages,
+            len,
+            hlen,
+            klen = strlen(key);
+    struct stat statb;
+    ssize_t got;
+    int fd;
+    bool ok = false;
+
+    EntryName(key, name, sizeof(name));
+    if ((fd = open(name, O_RDONLY)) < 0) {
+        misses++;
+        return false;
+    }
+    p = NULL;
+    got = pread(fd, head, sizeof(head) - 1, 0);
+    if (got > 0 && fstat(fd, &statb) == 0) {
+        head[got] = '\0';
+        if (sscanf(head, CACHE_MAGIC " %zu %zu %zu", &keylen, &npages, &len) == 3 &&
+            (p = strchr(head, '\n')) != NULL) {
+            hlen = p + 1 - head;
+            if (keylen == klen &&
+                (off_t) (hlen + keylen + npages * sizeof(long) + len) == statb.st_size &&
+                (p = (char *) malloc(keylen + npages * sizeof(long) + len + 1)) != NULL &&
+                pread(fd, p, statb.st_size - hlen, hlen) == (ssize_t) (statb.st_size - hlen) &&
+                memcmp(p, key, keylen) == 0) {
+                frag->pages.resize(npages);
+                memcpy(frag->pages.data(), p + keylen, npages * sizeof(long));
+                memmove(p, p + keylen + npages * sizeof(long), len);
+                frag->buf = p;
+                frag->len = len;
+                p = NULL;
+                ok = true;
+            }
+        }
+    }
+    free(p);
+    if (ok) {
+        futimens(fd, NULL);     /* recently used */
+        hits++;
+        bytes_read += statb.st_size;
+    } else {
+        misses++;
+    }
+    close(fd);
+    return ok;
+}
+
+
+/*
+ * save frag as the entry for key
+ */
+void FragmentCache::Store(const char *key, const Fragment &frag) {
+    char name[MAXPATHLEN + 64],
+            tmp[MAXPATHLEN + 64],
+            head[128];
+    size_t keylen = strlen(key);
+    int fd,
+            hlen;
+    bool ok;
+
+    EntryName(key, name, sizeof(name));
+    snprintf(tmp, sizeof(tmp), "%s/tmp.%d.%u", dir, (int) getpid(), tmp_serial++);
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0666)) < 0)
+        return;
+    hlen = snprintf(head, sizeof(head), CACHE_MAGIC " %zu %zu %zu\n", keylen, frag.pages.size(), frag.len);
+    ok = write(fd, head, hlen) == hlen &&
+         write(fd, key, keylen) == (ssize_t) keylen &&
+         write(fd, frag.pages.data(), frag.pages.size() * sizeof(long)) ==
+         (ssize_t) (frag.pages.size() * sizeof(long)) &&
+         write(fd, frag.buf, frag.len) == (ssize_t) frag.len;
+    if (close(fd) != 0 || !ok || rename(tmp, name) != 0) {
+        unlink(tmp);
+        return;
+    }
+    stored++;
+    bytes_written += hlen + keylen + frag.pages.size() * sizeof(long) + frag.len;
+}
+
+
+/*
+ * remove the least recently used entries until the cache fits in max_bytes
+ */
+void FragmentCache::Trim() {
+    struct entry {
+        struct timespec mtime;
+        off_t size;
+        std::string name;
+    };
+    std::vector<entry> entries;
+    char name[MAXPATHLEN + 64];
+    struct stat statb;
+    struct dirent *d;
+    long long total = 0;
+    size_t n;
+    DIR *dp;
+
+    if ((dp = opendir(dir)) == NULL)
+        return;
+    while ((d = readdir(dp)) != NULL) {
+        n = strlen(d->d_name);
+        if (n < 5 || strcmp(d->d_name + n - 5, ".frag") != 0)
+            continue;
+        snprintf(name, sizeof(name), "%s/%s", dir, d->d_name);
+        if (stat(name, &statb) != 0)
+            continue;
+        entries.push_back(entry{statb.st_mtim, statb.st_size, name});
+        total += statb.st_size;
+    }
+    closedir(dp);
+    if (total <= max_bytes)
+        return;
+    std::sort(entries.begin(), entries.end(), [](const entry &a, const entry &b) {
+        return a.mtime.tv_sec < b.mtime.tv_sec ||
+               (a.mtime.tv_sec == b.mtime.tv_sec && a.mtime.tv_nsec < b.mtime.tv_nsec);
+    });
+    for (const entry &e : entries) {
+        if (total <= max_bytes)
+            break;
+        if (unlink(e.name.c_str()) == 0) {
+            total -= e.size;
+            evicted++;
+        }
+    }
+}
+
+
+void FragmentCache::Report() {
+    fprintf(stderr, "%s: cache %s: %d hits, %d misses, %d stored, %d evicted, %lld kB read, %lld kB written\n",
+            argv0, dir, hits.load(), misses.load(), stored.load(), evicted.load(),
+            bytes_read.load() >> 10, bytes_written.load() >> 10);
+}
+
+
+std::vector<const lang_def_t *> lang_defs;     /* -lang definitions, as loaded */
+
+/*
+ * compile a parsed definition into a lang_image_t, which is returned in
+ * *image.  source is the definition's text.  Returns NULL or what is
+ * wrong with it.
+ */
+static const char *LangCompile(const lang_source_t &src, const std::string &source, std::string *image) {
+    lang_image_t head;
+    std::vector<std::string> words;
+    std::vector<signed char> offset;
+    std::vector<unsigned char> slot,
+            len;
+    unsigned n,
+            k,
+            h;
+    bool ok;
+
+    memset(&head, 0, sizeof(head));
+    strcpy(head.magic, LANG_CACHE_MAGIC);
+    head.source[0] = HashBytes(source.data(), source.size(), 1);
+    head.source[1] = HashBytes(source.data(), source.size(), 2);
+    if (src.name.size() >= sizeof(head.name))
+        return "language name too long";
+    strcpy(head.name, src.name.c_str());
+    strcpy(head.line_comment, src.line_comment.c_str());
+    strcpy(head.block_open, src.block_open.c_str());
+    strcpy(head.block_close, src.block_close.c_str());
+    head.directive = src.directive;
+    head.named_blocks = src.named_blocks;
+
+    /*
+     * the lexer classes, as LexBuild() has them; no character may have
+     * two meanings
+     */
+    unsigned char *cls = head.lex.cls;
+    auto set = [&](unsigned char c, unsigned char what) {
+        if (cls[c] != LX_PUNCT && cls[c] != what)
+            return false;
+        cls[c] = what;
+        return true;
+    };
+
+    for (unsigned c = 0; c < 256; c++) {
+        if (LexIsAlnum(c) || c == '_')
+            cls[c] = LX_WORD;
+        else if (c == ' ' || c == '\t' || c == '\v')
+            cls[c] = LX_BLANK;
+        else
+            cls[c] = LX_PUNCT;
+    }
+    cls['\n'] = cls['\r'] = cls['\f'] = cls['\0'] = LX_END;
+    ok = true;
+    for (char c : src.word)
+        ok &= set(c, LX_WORD);
+    for (char c : src.strings)
+        ok &= set(c, LX_QUOTE);
+    if (!src.line_comment.empty())
+        ok &= set(src.line_comment[0], LX_COMMENT);
+    if (!src.block_open.empty())
+        ok &= set(src.block_open[0], LX_COMMENT);
+    if (src.directive != 0)
+        ok &= set(src.directive, LX_DIRECTIVE);
+    if (!src.braces.empty())
+        ok &= set(src.braces[0], LX_BRACE_OPEN) && set(src.braces[1], LX_BRACE_CLOSE);
+    if (src.named_blocks)
+        ok &= set('[', LX_BRACKET_OPEN) && set(']', LX_BRACKET_CLOSE);
+    if (!ok)
+        return "a character has two meanings";
+    if (!src.block_close.empty() && (unsigned char) src.block_close[0] <= '\r')
+        return "bad comment delimiter";
+
+    /*
+     * the keywords, with the begin and end words and their func_depth
+     * offsets
+     */
+    auto add = [&](const std::string &w, int off) {
+        for (k = 0; k < words.size(); k++)
+            if (words[k] == w)
+                break;
+        if (k == words.size()) {
+            words.push_back(w);
+            offset.push_back(0);
+        }
+        if (off != 0)
+            offset[k] = (signed char) off;
+    };
+
+    for (const std::string &w : src.keywords)
+        add(w, 0);
+    for (const std::string &w : src.begin)
+        add(w, 1);
+    for (const std::string &w : src.end)
+        add(w, -1);
+    n = words.size();
+    if (n > 255)
+        return "more than 255 keywords";
+    for (k = 0; k < n; k++) {
+        if (words[k].size() > KW_MAX_LEN)
+            return "keyword too long";
+        len.push_back((unsigned char) words[k].size());
+        head.len_mask |= 1u << len[k];
+        head.first_mask[(unsigned char) words[k][0] >> 5] |= 1u << ((unsigned char) words[k][0] & 31);
+    }
+
+    /*
+     * a seed under which every keyword gets a slot of its own, as
+     * KwBuild() finds one, but with more slots if one doesn't come soon
+     */
+    auto place = [&]() {
+        slot.assign(head.nslots, 0);
+        for (k = 0; k < n; k++) {
+            h = KwHash(words[k].data(), len[k], head.seed) & (head.nslots - 1);
+            if (slot[h] != 0)
+                return false;
+            slot[h] = (unsigned char) (k + 1);
+        }
+        return true;
+    };
+
+    for (head.nslots = KwSlots(n); head.nslots <= (1u << 16); head.nslots *= 2)
+        for (head.seed = 1; head.seed < 10000; head.seed++)
+            if (place())
+                goto placed;
+    return "no perfect hash for the keywords";
+
+    placed:
+    head.nwords = n;
+
+    image->assign((const char *) &head, sizeof(head));
+    image->append((const char *) slot.data(), slot.size());
+    image->append((const char *) len.data(), n);
+    image->append((const char *) offset.data(), n);
+    for (const std::string &w : words)
+        image->append(w.c_str(), w.size() + 1);
+    image->push_back('\0');
+    for (const std::string &w : src.suffixes)
+        image->append(w.c_str(), w.size() + 1);
+    image->push_back('\0');
+    ((lang_image_t *) &(*image)[0])->size = image->size();
+    return NULL;
+}
+
+/*
+ * the definition in an image (size bytes, which must stay put), or NULL
+ * if it is not whole or doesn't check out.  A cached image is trusted no
+ * further than this: everything the lexer and KwFind() index by or read
+ * up to a NUL is checked.
+ */
+static lang_def_t *LangAttach(const char *buf, size_t size) {
+    const lang_image_t *image = (const lang_image_t *) buf;
+    lang_def_t *def;
+    const char *p,
+            *end = buf + size;
+    unsigned k;
+
+    if (size < sizeof(lang_image_t) || strcmp(image->magic, LANG_CACHE_MAGIC) != 0 ||
+        image->size != size || image->nwords > 255 ||
+        image->nslots == 0 || (image->nslots & (image->nslots - 1)) != 0 || image->nslots > (1u << 16) ||
+        sizeof(lang_image_t) + image->nslots + 2 * image->nwords >= size ||
+        end[-1] != '\0' || memchr(image->name, '\0', sizeof(image->name)) == NULL ||
+        memchr(image->line_comment, '\0', sizeof(image->line_comment)) == NULL ||
+        memchr(image->block_open, '\0', sizeof(image->block_open)) == NULL ||
+        memchr(image->block_close, '\0', sizeof(image->block_close)) == NULL)
+        return NULL;
+
+    /* only the classes LangCompile() gives, and a line ends where it must */
+    for (k = 0; k < 256; k++)
+        if (image->lex.cls[k] > LX_BRACKET_CLOSE ||
+            (image->lex.cls[k] == LX_END) != (k == '\n' || k == '\r' || k == '\f' || k == '\0'))
+            return NULL;
+
+    /* slots name keywords that exist, of lengths the tables can hold */
+    const unsigned char *slots = (const unsigned char *) buf + sizeof(lang_image_t);
+    for (k = 0; k < image->nslots; k++)
+        if (slots[k] > image->nwords)
+            return NULL;
+    for (k = 0; k < image->nwords; k++)
+        if (slots[image->nslots + k] > KW_MAX_LEN)
+            return NULL;
+
+    def = new lang_def_t;
+    def->image = image;
+    p = buf + sizeof(lang_image_t) + image->nslots + 2 * image->nwords;
+    for (; p < end && *p != '\0'; p += strlen(p) + 1)
+        def->words.push_back(p);
+    for (p++; p < end && *p != '\0'; p += strlen(p) + 1)
+        def->suffixes.push_back(p);
+
+    def->keywords = {def->words.data(), slots + image->nslots,
+                     (const signed char *) slots + image->nslots + image->nwords, slots,
+                     image->first_mask, image->nslots - 1, image->seed, image->len_mask};
+
+    /* every keyword has to be found, or the table is no good */
+    bool ok = def->words.size() == image->nwords;
+    for (k = 0; ok && k < image->nwords; k++)
+        ok = def->keywords.len[k] == strlen(def->words[k]) &&
+             KwFind(&def->keywords, def->words[k], def->keywords.len[k]) == (int) k;
+    if (!ok) {
+        delete def;
+        return NULL;
+    }
+    return def;
+}
+
+/*
+ * the directory compiled definitions are kept in: the -cache directory
+ * if there is one, else $XDG_CACHE_HOME/c2ps or ~/.cache/c2ps.  Empty if
+ * there is nowhere to put them.
+ */
+static void LangCacheDir(const char *cache_dir, char *dir, size_t size) {
+    const char *home;
+
+    dir[0] = '\0';
+    if (cache_dir != NULL) {
+        snprintf(dir, size, "%s", cache_dir);
+    } else if ((home = getenv("XDG_CACHE_HOME")) != NULL && home[0] == '/') {
+        snprintf(dir, size, "%s/c2ps", home);
+    } else if ((home = getenv("HOME")) != NULL && home[0] == '/') {
+        snprintf(dir, size, "%s/.cache", home);
+        mkdir(dir, 0777);
+        snprintf(dir, size, "%s/.cache/c2ps", home);
+    }
+    if (dir[0] != '\0' && mkdir(dir, 0777) != 0 && errno != EEXIST)
+        dir[0] = '\0';
+}
+
+/*
+ * read the definition file path, compiled from the cache if it is there,
+ * and add it to the languages c2ps knows.  Exits if it is no good.
+ */
+const lang_def_t *LoadLanguage(const char *path, const char *cache_dir) {
+    std::string text,
+            image;
+    lang_source_t src;
+    lang_def_t *def = NULL;
+    char dir[MAXPATHLEN],
+            name[MAXPATHLEN + 64],
+            tmp[MAXPATHLEN + 64];
+    const char *err;
+    struct stat statb;
+    char *buf;
+    int fd;
+    bool ok;
+
+    if (!ReadLanguage(argv0, path, &text, &src))
+        exit(1);
+    LangCacheDir(cache_dir, dir, sizeof(dir));
+    if (dir[0] != '\0') {
+        snprintf(name, sizeof(name), "%s/%016llx%016llx.lang", dir,
+                HashBytes(text.data(), text.size(), 1), HashBytes(text.data(), text.size(), 2));
+        if ((fd = open(name, O_RDONLY)) >= 0) {
+            if (fstat(fd, &statb) == 0 && statb.st_size > 0 &&
+                (buf = (char *) malloc(statb.st_size)) != NULL) {
+                if (read(fd, buf, statb.st_size) != statb.st_size ||
+                    (def = LangAttach(buf, statb.st_size)) == NULL ||
+                    def->image->source[0] != HashBytes(text.data(), text.size(), 1) ||
+                    def->image->source[1] != HashBytes(text.data(), text.size(), 2)) {
+                    delete def;
+                    def = NULL;
+                    free(buf);
+                }
+            }
+            close(fd);
+        }
+    }
+
+    if (def == NULL) {
+        if ((err = LangCompile(src, text, &image)) != NULL) {
+            fprintf(stderr, "%s: %s: %s\n", argv0, path, err);
+            exit(1);
+        }
+        if (dir[0] != '\0') {
+            /* as FragmentCache::Store() does, so c2ps processes can share it */
+            snprintf(tmp, sizeof(tmp), "%s/tmp.%d.lang", dir, (int) getpid());
+            if ((fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0666)) >= 0) {
+                ok = write(fd, image.data(), image.size()) == (ssize_t) image.size();
+                if (close(fd) != 0 || !ok || rename(tmp, name) != 0)
+                    unlink(tmp);
+            }
+        }
+        buf = (char *) malloc(image.size());
+        memcpy(buf, image.data(), image.size());
+        def = LangAttach(buf, image.size());
+    }
+    lang_defs.push_back(def);
+    return def;
+}
+
+/*
+ * the loaded language called name, or NULL; a later definition of a
+ * name replaces an earlier one
+ */
+const lang_def_t *FindLanguage(const char *name) {
+    for (size_t k = lang_defs.size(); k-- > 0;)
+        if (strcmp(lang_defs[k]->image->name, name) == 0)
+            return lang_defs[k];
+    return NULL;
+}
+
+/*
+ * the loaded language a file is listed in going by its suffix, or NULL.
+ * These come before the built in languages' suffixes.
+ */
+const lang_def_t *LanguageDefForName(const char *fname) {
+    const char *dotpos = strrchr(fname, '.');
+
+    if (dotpos != NULL)
+        for (size_t k = lang_defs.size(); k-- > 0;)
+            for (const char *s : lang_defs[k]->suffixes)
+                if (strcmp(dotpos, s) == 0)
+                    return lang_defs[k];
+    return NULL;
+}
+
+
+/*
+ * Render the input files in jobs on nthreads worker threads, biggest
+ * files first, and write them into doc's document in command line order.
+ * Each file's pages are written as soon as it and every file before it
+ * are done.
+ */
+void RenderParallel(Renderer *doc, std::vector<RenderOptions> &jobs, int nthreads) {
+    std::vector<Fragment> frags(jobs.size());
+    std::vector<size_t> order(jobs.size());
+    std::vector<off_t> sizes(jobs.size());
+    std::vector<std::thread> workers;
+    std::atomic<size_t> next(0);
+    std::mutex lock;
+    std::condition_variable finished;
+    struct stat statb;
+    size_t k;
+
+    for (k = 0; k < jobs.size(); k++) {
+        order[k] = k;
+        if (jobs[k].ifname[0] == '-')
+            sizes[k] = (off_t) 1 << 62;     /* stdin: size unknown, start it early */
+        else if (stat(jobs[k].ifname, &statb) == 0)
+            sizes[k] = statb.st_size;
+        else
+            sizes[k] = 0;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return sizes[a] > sizes[b];
+    });
+
+    for (int t = 0; t < nthreads; t++) {
+        workers.emplace_back([&]() {
+            Renderer *r = new Renderer;
+            size_t n;
+
+            while ((n = next++) < order.size()) {
+                Fragment *frag = &frags[order[n]];
+
+                static_cast<RenderOptions &>(*r) = jobs[order[n]];
+                r->CopyLayout(*doc);
+                r->RenderFragment(frag);
+                std::lock_guard<std::mutex> guard(lock);
+                frag->done = true;
+                finished.notify_all();
+            }
+            delete r;
+        });
+    }
+
+    for (k = 0; k < frags.size(); k++) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            finished.wait(guard, [&]() { return frags[k].done; });
+        }
+        if (frags[k].error != 0) {
+            /* same as the serial case, but don't flush the workers' streams */
+            fprintf(stderr, "%s : can't open '%s' %s\n", argv0, jobs[k].ifname, strerror(frags[k].error));
+            doc->out.Flush();
+            _exit(1);
+        }
+        doc->WriteFragment(frags[k]);
+        free(frags[k].buf);
+        frags[k].buf = NULL;
+    }
+    for (std::thread &w : workers)
+        w.join();
 }
@@ -1,9 +1,20 @@
-#include <fstream>
 #include <iostream>
 #include <iomanip>
 #include <vector>
 #include <string>
 #include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "layout.h"
+#include "scan.h"
 
 using namespace std;
 
@@ -13,17 +24,23 @@ struct fdata_t {
   static unsigned int max_fname_len;
   static unsigned int nup;
   static unsigned int nrows;
+  static bool exact;            // -exact: c2ps's pages, see layout.h
+  static unsigned int page_skip;
+  static int top;
+  static int wrap_col;
   bool processed;
+  bool text;                    // c2ps lists it as -text
   unsigned int max_col;
   unsigned int lines;
   unsigned int pages;
   const char* fname;
-  fdata_t(const char* fname_p = 0) :
+  fdata_t(const char* fname_p = 0, bool text_p = false) :
     fname(fname_p),
     max_col(0),
     lines(0),
     pages(0),
-    processed(false)
+    processed(false),
+    text(text_p)
   {
     int len = (fname_p != 0) ? strlen(fname_p) : 0;
     if (len > max_fname_len)
@@ -34,7 +51,7 @@ struct fdata_t {
       max_col = f.max_col;
     lines += f.lines;
     pages += f.pages;
-    if (fdata_t::nup == 2) {
+    if ((fdata_t::nup == 2) && !fdata_t::exact) {
 	if ((f.pages % 2) == 1)
 	    pages++;
     }
@@ -45,113 +62,540 @@ struct fdata_t {
 unsigned int fdata_t::max_fname_len = 0;
 unsigned int fdata_t::nup = 2;
 unsigned int fdata_t::nrows = 50;
+bool fdata_t::exact = false;
+unsigned int fdata_t::page_skip = 1;
+int fdata_t::top;
+int fdata_t::wrap_col;
 
 const char* program_name = "??";
 
 ostream& operator<< (ostream& s, const fdata_t& f) {
-  s << setw(f.max_fname_len+2) << f.fname;
+  // (a null char* would put s in a failed state, and print nothing more)
+  s << setw(f.max_fname_len+2) << ((f.fname != 0) ? f.fname : "-");
   s << setw(5) << f.pages << " page" << ((f.pages > 1) ? "s " : "  ");
   s << setw(6) << f.lines << " line" << ((f.lines > 1) ? "s " : "  ");
   s << setw(6) << f.max_col << " max col" << endl;
   return s;
 }
 
-void
-process(fdata_t& f)
+/*
+ * Input is counted a block at a time: the CountMasks function for this
+ * machine marks every newline, formfeed and tab in the block, and only
+ * those bytes are looked at one by one.  Everything between two of them
+ * just moves the column along.
+ *
+ * A block is boiled down to a span_t, what it does to the counts
+ * whatever column and row it starts at, so blocks, and pieces of a big
+ * file counted on different threads, can be summed up separately and
+ * combined in order afterwards.
+ */
+#define COUNT_BLOCK (64 * 1024)
+#define READ_BLOCK (128 * 1024)
+#define PIECE_SIZE (16 << 20)   /* -j splits regular files bigger than this */
+
+static CountMasksFn* count_masks = CountMasksFor();
+
+struct span_t {
+  // the first line, up to the first '\n' or '\f' (all of it if there
+  // is none), takes column c to c + lead_add, or if it has a tab, to
+  // ((c + lead_add) | 7) + 1 + lead_tab
+  bool ended;                   // there is a '\n' or '\f'
+  bool tabbed;
+  unsigned int lead_add;
+  unsigned int lead_tab;
+  unsigned int inner_max;       // widest line that starts and ends inside
+  unsigned int tail_col;        // column after the last '\n' or '\f'
+  unsigned int lines;
+  // rows: newlines before the first '\f', then from the first '\f' on,
+  // the pages it makes and the row it leaves
+  bool fed;                     // there is a '\f'
+  unsigned int lead_nl;
+  unsigned int inner_pages;
+  unsigned int tail_row;
+
+  span_t() :
+    ended(false), tabbed(false), lead_add(0), lead_tab(0),
+    inner_max(0), tail_col(0), lines(0),
+    fed(false), lead_nl(0), inner_pages(0), tail_row(0)
+  {}
+
+  unsigned int lead(unsigned int col) const {
+    return tabbed ? ((col + lead_add) | 7) + 1 + lead_tab : col + lead_add;
+  }
+  // col is where the first line got to from column 0
+  void set_lead(unsigned int col) {
+    if (tabbed)
+      lead_tab = col - ((lead_add | 7) + 1);
+    else
+      lead_add = col;
+  }
+  span_t& operator += (const span_t& b);
+};
+
+// rows a page runs to before a newline starts the next: row++ > nrows
+#define PAGE_PERIOD (fdata_t::nrows + 2)
+
+/*
+ * this span followed by b
+ */
+span_t&
+span_t::operator += (const span_t& b)
 {
-  ifstream fs;
-  istream* s = 0;
-  if (f.fname != 0) {
-    fs.open(f.fname);
-    if (fs) s = &fs;
+  if (!ended) {
+    if (!b.tabbed) {
+      if (tabbed)
+	lead_tab += b.lead_add;
+      else
+	lead_add += b.lead_add;
+    } else if (!tabbed) {
+      lead_add += b.lead_add;
+      tabbed = true;
+      lead_tab = b.lead_tab;
+    } else {
+      lead_tab = ((lead_tab + b.lead_add) | 7) + 1 + b.lead_tab;
+    }
+    ended = b.ended;
+    inner_max = b.inner_max;
+    tail_col = b.tail_col;
+  } else if (b.ended) {
+    inner_max = max(max(inner_max, b.lead(tail_col)), b.inner_max);
+    tail_col = b.tail_col;
+  } else {
+    tail_col = b.lead(tail_col);
+  }
+  lines += b.lines;
+
+  if (!fed) {
+    lead_nl += b.lead_nl;
+    if (b.fed) {
+      fed = true;
+      inner_pages = b.inner_pages;
+      tail_row = b.tail_row;
+    }
   } else {
-    s = &cin;
+    inner_pages += (tail_row + b.lead_nl) / PAGE_PERIOD;
+    tail_row = (tail_row + b.lead_nl) % PAGE_PERIOD;
+    if (b.fed) {
+      inner_pages += b.inner_pages;
+      tail_row = b.tail_row;
+    }
   }
-  if (s != 0) {
-    int c;
+  return *this;
+}
+
+static span_t
+count_block(const char* p, size_t n)
+{
+  uint64_t masks[COUNT_BLOCK / 64];
+  size_t full = n & ~(size_t) 63;
+  size_t last = 0;
+  unsigned int col = 0;
+  span_t s;
+
+  count_masks(p, full, masks);
+  if (full < n) {
+    char tail[64] = { 0 };
+    memcpy(tail, p + full, n - full);
+    count_masks(tail, 64, &masks[full / 64]);
+  }
+  for (size_t k = 0; k < (n + 63) / 64; k++) {
+    for (uint64_t m = masks[k]; m != 0; m &= m - 1) {
+      size_t i = k * 64 + __builtin_ctzll(m);
+      col += i - last;
+      last = i + 1;
+      if (p[i] == '\t') {
+	if (!s.ended && !s.tabbed) {
+	  s.tabbed = true;
+	  s.lead_add = col;
+	}
+	col = (col | 7) + 1;
+	continue;
+      }
+      if (!s.ended) {
+	s.ended = true;
+	s.set_lead(col);
+      } else if (col > s.inner_max) {
+	s.inner_max = col;
+      }
+      s.lines++;
+      if (p[i] == '\f') {
+	s.fed = true;
+	s.inner_pages++;
+	s.tail_row = 0;
+      } else if (!s.fed) {
+	s.lead_nl++;
+      } else if (s.tail_row++ > fdata_t::nrows) {
+	s.inner_pages++;
+	s.tail_row = 0;
+      }
+      col = 0;
+    }
+  }
+  col += n - last;
+  if (s.ended)
+    s.tail_col = col;
+  else
+    s.set_lead(col);
+  return s;
+}
+
+static span_t
+count_bytes(const char* p, size_t n)
+{
+  span_t s;
+  for (size_t done = 0; done < n; done += COUNT_BLOCK) {
+    s += count_block(p + done, min(n - done, (size_t) COUNT_BLOCK));
+  }
+  return s;
+}
+
+/*
+ * run a span on from column col and row row of f
+ */
+static void
+add_span(fdata_t& f, const span_t& s, unsigned int& col, unsigned int& row)
+{
+  f.lines += s.lines;
+  if (s.ended) {
+    f.max_col = max(max(f.max_col, s.lead(col)), s.inner_max);
+    col = s.tail_col;
+  } else {
+    col = s.lead(col);
+  }
+  f.pages += (row + s.lead_nl) / PAGE_PERIOD;
+  row = (row + s.lead_nl) % PAGE_PERIOD;
+  if (s.fed) {
+    f.pages += s.inner_pages;
+    row = s.tail_row;
+  }
+}
+
+/*
+ * the last line, if it has no newline
+ */
+static void
+end_file(fdata_t& f, unsigned int col, unsigned int row)
+{
+  if (col > f.max_col) {
+    f.max_col = col;
+  }
+  if ((row > 0) || (col > 0)) {
+    f.lines++;
+    f.pages++;
+  }
+  f.processed = true;
+}
+
+void
+process(fdata_t& f)
+{
+  int fd = (f.fname != 0) ? open(f.fname, O_RDONLY) : 0;
+  if (fd >= 0) {
+    vector<char> buf(READ_BLOCK);
+    ssize_t n;
+    unsigned int col = 0;
+    unsigned int row = 0;
+    Paginator paginator;
     f.lines = 0;
     f.pages = 0;
     f.max_col = 0;
-    int col = 0;
-    int row = 0;
-    c = (*s).get();
-    while (*s && (c != EOF)) {
-      if (c == '\f') {
-	f.lines++;
-	f.pages++;
-	col = 0;
-	row = 0;
-      } else if (c == '\n') {
-	f.lines++;
-	if (row++ > f.nrows) {
-	  f.pages++;
-	  row = 0;
-	}
-	col = 0;
-      } else if (c == '\t') {
-	while ((++col) % 8 != 0) {
-	  /* nothing */
-	}
-      } else {
-	col++;
-      }
-      if (col > f.max_col) {
-	f.max_col = col;
+    paginator.Start(fdata_t::top, fdata_t::wrap_col, f.text);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    while ((n = read(fd, &buf[0], buf.size())) > 0) {
+      add_span(f, count_bytes(&buf[0], n), col, row);
+      if (fdata_t::exact) {
+	paginator.Feed(&buf[0], n);
       }
-      c = (*s).get();
     }
-    if ((row > 0) || (col > 0)) {
-      f.lines++;
-      f.pages++;
-      row = 0;
-      col = 0;
+    end_file(f, col, row);
+    if (fdata_t::exact) {
+      f.pages = paginator.Finish(fdata_t::page_skip);
     }
-    f.processed = true;
-    if (f.fname) fs.close();
+    if (f.fname) close(fd);
   } else {
-    cerr << program_name << ": Can't open " << f.fname << " ignroring file" << endl;
+    // one write, so messages from -j threads don't run together
+    cerr << string(program_name) + ": Can't open " + f.fname + " ignroring file\n";
   }
   
 }
 
+/*
+ * count length bytes of fd from offset on; false if it can't be read
+ */
+static bool
+process_piece(int fd, off_t offset, off_t length, span_t& s)
+{
+  vector<char> buf(READ_BLOCK);
+  ssize_t n;
+
+  posix_fadvise(fd, offset, length, POSIX_FADV_SEQUENTIAL);
+  while (length > 0) {
+    n = pread(fd, &buf[0], min(length, (off_t) buf.size()), offset);
+    if (n <= 0) {
+      return false;
+    }
+    s += count_bytes(&buf[0], n);
+    offset += n;
+    length -= n;
+  }
+  return true;
+}
+
+/*
+ * -j: the files are counted on nthreads threads, handed out biggest
+ * first from a shared index so a thread that finishes early just takes
+ * the next one.  A regular file bigger than PIECE_SIZE is handed out as
+ * several pieces, each summed up into a span_t; whichever thread counts
+ * a file's last piece adds the spans up in order.  Standard input is
+ * counted before the threads start, since only the first "-" gets
+ * anything.  wait_for() blocks until file k is done, so the caller can
+ * print in command line order as files finish.
+ */
+struct pool_t {
+  struct job_t {
+    size_t file;
+    size_t piece;               // of split[file], unless the file is whole
+    off_t offset;
+    off_t length;
+  };
+  struct split_t {
+    vector<span_t> spans;
+    size_t left;
+    bool failed;
+  };
+  vector<fdata_t>* files;
+  vector<job_t> jobs;
+  vector<split_t> split;
+  vector<char> done;
+  atomic<size_t> next;
+  mutex lock;
+  condition_variable finished;
+  vector<thread> workers;
+
+  void start(vector<fdata_t>& f, int nthreads);
+  void run(const job_t& job);
+  void wait_for(size_t k);
+  void join();
+};
+
+void
+pool_t::start(vector<fdata_t>& f, int nthreads)
+{
+  vector<off_t> sizes(f.size());
+  struct stat st;
+
+  files = &f;
+  done.assign(f.size(), 0);
+  split.assign(f.size(), split_t());
+  next = 0;
+  for (size_t k = 0; k < f.size(); k++) {
+    if (f[k].fname == 0) {
+      process(f[k]);
+      done[k] = 1;
+      continue;
+    }
+    if ((stat(f[k].fname, &st) == 0) && S_ISREG(st.st_mode)) {
+      sizes[k] = st.st_size;
+    }
+    // -exact pages have to be laid out in order
+    size_t pieces = (sizes[k] + PIECE_SIZE - 1) / PIECE_SIZE;
+    if ((pieces < 2) || fdata_t::exact) {
+      jobs.push_back({ k, 0, 0, -1 });
+      continue;
+    }
+    split[k].spans.resize(pieces);
+    split[k].left = pieces;
+    split[k].failed = false;
+    for (size_t n = 0; n < pieces; n++) {
+      off_t offset = n * (off_t) PIECE_SIZE;
+      jobs.push_back({ k, n, offset, min((off_t) PIECE_SIZE, sizes[k] - offset) });
+    }
+  }
+  stable_sort(jobs.begin(), jobs.end(), [&](const job_t& a, const job_t& b) {
+    return ((a.length < 0) ? sizes[a.file] : a.length) > ((b.length < 0) ? sizes[b.file] : b.length);
+  });
+
+  for (int t = 0; t < nthreads; t++) {
+    workers.emplace_back([this]() {
+      size_t n;
+      while ((n = next++) < jobs.size()) {
+	run(jobs[n]);
+      }
+    });
+  }
+}
+
+void
+pool_t::run(const job_t& job)
+{
+  fdata_t& f = (*files)[job.file];
+
+  if (job.length < 0) {
+    process(f);
+    lock_guard<mutex> guard(lock);
+    done[job.file] = 1;
+    finished.notify_all();
+    return;
+  }
+
+  span_t s;
+  int fd = open(f.fname, O_RDONLY);
+  bool ok = (fd >= 0) && process_piece(fd, job.offset, job.length, s);
+  if (fd >= 0) close(fd);
+
+  lock_guard<mutex> guard(lock);
+  split_t& sp = split[job.file];
+  sp.spans[job.piece] = s;
+  sp.failed |= !ok;
+  if (--sp.left > 0) {
+    return;
+  }
+  if (sp.failed) {
+    cerr << string(program_name) + ": Can't open " + f.fname + " ignroring file\n";
+  } else {
+    unsigned int col = 0;
+    unsigned int row = 0;
+    for (size_t n = 0; n < sp.spans.size(); n++) {
+      add_span(f, sp.spans[n], col, row);
+    }
+    end_file(f, col, row);
+  }
+  done[job.file] = 1;
+  finished.notify_all();
+}
+
+void
+pool_t::wait_for(size_t k)
+{
+  unique_lock<mutex> guard(lock);
+  finished.wait(guard, [&]() { return done[k] != 0; });
+}
+
+void
+pool_t::join()
+{
+  for (size_t t = 0; t < workers.size(); t++) {
+    workers[t].join();
+  }
+}
+
+// whether c2ps lists name as plain text when the suffix decides; the
+// -lang definitions come first, as in c2ps
+bool
+text_by_name(const char* name, const vector<lang_source_t>& langs)
+{
+  for (size_t l = langs.size(); l-- > 0; ) {
+    if (HasSuffix(name, langs[l].suffixes)) {
+      return false;
+    }
+  }
+  return LanguageForName(name) == 0;
+}
+
+void
+usage()
+{
+  cerr << "Usage: count [-1] [-2] [-50] [-66] [-j threads] [files or -]" << endl;
+  cerr << "       count -exact [-letter | -a3 | -a4 | -legal | -ledger] [-rotate]" << endl;
+  cerr << "             [-1 | -2 | -4 | -8] [-text | -c | -c++ | -trellis | -verilog | -vera | -ext]" << endl;
+  cerr << "             [-lang definition-file] [-language name] [-j threads] [files or -]" << endl;
+  exit(1);
+}
+
 int
 main(int argc, char** argv)
 {
   vector<fdata_t> files;
+  int nthreads = 1;
+  int paper_size = 0;
+  bool rotate_text = false;
+  bool text_mode = false;       // c2ps's -text
+  bool language_set = false;    // else the suffix decides
+  vector<lang_source_t> langs;  // from -lang
+  string lang_text;
+  pool_t pool;
 
   program_name = argv[0];
 
   if (argc == 1) {
-    cerr << "Usage: count [-1] [-2] [-50] [-66] [files or -]" << endl;
-    exit(1);
+    usage();
   }
   for (int i = 1; i < argc; i++) {
     //cout << i << " " << argv[i] << endl;
+    int paper = 0;
+    while ((paper <= MAX_PAPER_SIZE) && (strcmp(argv[i], paper_sizes[paper].name) != 0)) {
+      paper++;
+    }
     if (strcmp(argv[i], "-") == 0) {
-      fdata_t fdata_stdin(0);
+      fdata_t fdata_stdin(0, language_set ? text_mode : text_by_name("-", langs));
       files.push_back(fdata_stdin);
     } else if (strcmp(argv[i], "-1") == 0) {
 	fdata_t::nup = 1;
+	fdata_t::page_skip = 1;
     } else if (strcmp(argv[i], "-2") == 0) {
 	fdata_t::nup = 2;
+	fdata_t::page_skip = 2;
+    } else if (strcmp(argv[i], "-4") == 0) {
+	fdata_t::page_skip = 4;
+    } else if (strcmp(argv[i], "-8") == 0) {
+	fdata_t::page_skip = 8;
+    } else if (strcmp(argv[i], "-exact") == 0) {
+	fdata_t::exact = true;
+    } else if (paper <= MAX_PAPER_SIZE) {
+	paper_size = paper;
+    } else if (strcmp(argv[i], "-rotate") == 0) {
+	rotate_text = true;
+    } else if (strcmp(argv[i], "-text") == 0) {
+	text_mode = true;
+    } else if ((strcmp(argv[i], "-c") == 0) || (strcmp(argv[i], "-c++") == 0) ||
+	       (strcmp(argv[i], "-trellis") == 0) || (strcmp(argv[i], "-verilog") == 0) ||
+	       (strcmp(argv[i], "-vera") == 0)) {
+	text_mode = false;
+	language_set = true;
+    } else if (strcmp(argv[i], "-ext") == 0) {
+	text_mode = false;
+	language_set = false;
+    } else if ((strcmp(argv[i], "-lang") == 0) && ((i + 1) < argc)) {
+	// only the suffixes matter to the page count
+	langs.emplace_back();
+	if (!ReadLanguage(program_name, argv[++i], &lang_text, &langs.back())) {
+	  exit(1);
+	}
+    } else if ((strcmp(argv[i], "-language") == 0) && ((i + 1) < argc)) {
+	i++;
+	text_mode = false;
+	language_set = true;
     } else if (strcmp(argv[i], "-50") == 0) {
 	fdata_t::nrows = 50;
     } else if (strcmp(argv[i], "-66") == 0) {
 	fdata_t::nrows = 66;
+    } else if ((strcmp(argv[i], "-j") == 0) && ((i + 1) < argc)) {
+	nthreads = atoi(argv[++i]);
+	if (nthreads < 1) {
+	  usage();
+	}
     } else {
-      fdata_t fdata_argv(argv[i]);
+      fdata_t fdata_argv(argv[i], language_set ? text_mode : text_by_name(argv[i], langs));
       files.push_back(fdata_argv);
     }
   }
+  PageLayout(paper_size, rotate_text, &fdata_t::top, &fdata_t::wrap_col);
 
   vector<fdata_t>::iterator fi;
-  for (fi = files.begin(); fi != files.end(); ++fi) {
-    process(*fi);
+  if (nthreads > 1) {
+    pool.start(files, nthreads);
+  } else {
+    for (fi = files.begin(); fi != files.end(); ++fi) {
+      process(*fi);
+    }
   }
 
   fdata_t total("TOTAL-->");
   int i = 0;
   for (fi = files.begin(); fi != files.end(); ++fi) {
+    if (nthreads > 1) {
+      pool.wait_for(fi - files.begin());
+    }
     if (fi->processed) {
       cout << *fi;
       total = total + *fi;
@@ -161,6 +605,7 @@ main(int argc, char** argv)
   if (i > 1) {
     cout << total;
   }
+  pool.join();
   return 0;
 }
 
@@ -0,0 +1,401 @@
+/*
+ * $Header: layout.h $
+ *
+ * c2ps page layout without the PostScript: the paper geometry, which
+ * files are listed as program text and which as plain text, and a
+ * Paginator that runs input through c2ps's rules for starting pages and
+ * reports how many a file takes.  c2ps -dry-run and count -exact use it
+ * to predict page counts, so it has to follow ParseFile(), InFileLine()
+ * and WrapLine() exactly; change them together.  The language definition
+ * files of c2ps -lang are parsed here too, so that count knows their
+ * suffixes.
+ */
+
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "metrics.h"
+#include "scan.h"
+
+#define LINEWIDTH       12
+#define NORMFSIZE       10
+#define SMALLFSIZE      8       /* -text lines and line numbers */
+#define BOTTOM          72
+#define LMARG           60
+
+#define LANG_C      1
+#define LANG_TRELLIS    2
+#define LANG_CPP    3
+#define LANG_VERILOG    4
+#define LANG_VERA   5
+#define LANG_DEFINED    6   /* read from a definition file, see ParseLanguage() */
+
+static const struct paper_size {
+    const char *name;
+    int x;
+    int y;
+} paper_sizes[] = {
+        {"-letter", 612, 792},
+        {"-a3",     594, 846},
+        {"-a4",     846, 1184},
+        {"-legal",  612, 1108},
+        {"-ledger", 792, 1224}};
+
+#define MAX_PAPER_SIZE 4    /* -ledger */
+
+/*
+ * the paper size, with x and y swapped for -rotate
+ */
+static inline void PaperBox(int paper_size, int rotate_text, int *urx, int *ury) {
+    if (rotate_text) {
+        *urx = paper_sizes[paper_size].y;
+        *ury = paper_sizes[paper_size].x;
+    } else {
+        *urx = paper_sizes[paper_size].x;
+        *ury = paper_sizes[paper_size].y;
+    }
+}
+
+/* y of the first line on a page */
+static inline int PageTop(int ury) {
+    return ury - NORMFSIZE - 90;
+}
+
+static inline int RightMargin(int urx) {
+    return urx - 36;
+}
+
+/*
+ * where -text lines wrap: as many characters of SMALLFSIZE Courier as
+ * fit between the margins, rounded down to the nearest multiple of 8
+ */
+static inline int WrapColumn(int rmarg) {
+    return ((((rmarg - LMARG) * 1000) / (COURIER_WIDTH * SMALLFSIZE)) / 8) * 8;
+}
+
+/*
+ * the y of the first line and the -text wrap column for a paper size
+ */
+static inline void PageLayout(int paper_size, int rotate_text, int *top, int *wrap_col) {
+    int urx,
+            ury;
+
+    PaperBox(paper_size, rotate_text, &urx, &ury);
+    *top = PageTop(ury);
+    *wrap_col = WrapColumn(RightMargin(urx));
+}
+
+/*
+ * the language a file is listed in going by its suffix, or 0 if it is
+ * listed as plain text (-text)
+ */
+static inline int LanguageForName(const char *name) {
+    static const struct {
+        const char *suffix;
+        int language;
+    } suffixes[] = {
+            {".c",       LANG_C},
+            {".h",       LANG_C},
+            {".cxx",     LANG_CPP},
+            {".hxx",     LANG_CPP},
+            {".icc",     LANG_CPP},
+            {".cpp",     LANG_CPP},
+            {".hpp",     LANG_CPP},
+            {".C",       LANG_CPP},
+            {".H",       LANG_CPP},
+            {".cc",      LANG_CPP},
+            {".hh",      LANG_CPP},
+            {".CC",      LANG_CPP},
+            {".HH",      LANG_CPP},
+            {".verilog", LANG_VERILOG},
+            {".v",       LANG_VERILOG},
+            {".vh",      LANG_VERILOG},
+            {".vs",      LANG_VERILOG},
+            {".vr",      LANG_VERA},
+            {".vrh",     LANG_VERA},
+            {".trellis", LANG_TRELLIS}};
+    const char *dotpos = strrchr(name, '.');
+
+    if (dotpos != NULL)
+        for (const auto &s : suffixes)
+            if (strcmp(dotpos, s.suffix) == 0)
+                return s.language;
+    return 0;
+}
+
+/*
+ * A language definition file (c2ps -lang file) describes one more
+ * language for c2ps to list.  Each line is a setting and its values,
+ * separated by blanks; empty lines and lines starting with '#' are
+ * skipped.
+ *
+ *   language NAME              what c2ps -language NAME selects
+ *   suffixes .py .pyw ...      files listed in it, as for LanguageForName()
+ *   keywords WORD ...          words shown in the keyword font (repeatable)
+ *   word CHARS                 characters other than letters, digits and
+ *                              '_' that can be part of a word
+ *   strings CHARS              characters that start a string, which ends
+ *                              at the same character; '\' escapes
+ *   line-comment OPEN          starts a comment that ends with the line
+ *   block-comment OPEN CLOSE   starts a comment that ends at CLOSE
+ *   directive CHAR             starts a preprocessor line, which a '\' at
+ *                              its end continues
+ *   braces OPEN CLOSE          open and close a function body, like C's {}
+ *   begin WORD ...             keywords that open a block, like braces
+ *   end WORD ...               keywords that close one
+ *   named-blocks               the word after a begin word is a function
+ *                              name, as Verilog's module name is
+ *
+ * Comment delimiters are one or two characters.  The begin and end words
+ * are keywords as well.
+ */
+struct lang_source_t {
+    std::string name,
+            word,
+            strings,
+            line_comment,
+            block_open,
+            block_close,
+            braces;
+    char directive = 0;
+    bool named_blocks = false;
+    std::vector<std::string> suffixes,
+            keywords,
+            begin,
+            end;
+};
+
+/*
+ * parse the definition in text (n bytes) into *def.  Returns NULL, or
+ * what is wrong with it and the line number in *line.
+ */
+static inline const char *ParseLanguage(const char *text, size_t n, lang_source_t *def, int *line) {
+    const char *end = text + n,
+            *eol;
+    std::vector<std::string> v;
+    std::string key;
+
+    *def = lang_source_t();
+    for (*line = 1; text < end; text = eol + 1, ++*line) {
+        if ((eol = (const char *) memchr(text, '\n', end - text)) == NULL)
+            eol = end;
+        v.clear();
+        for (const char *p = text, *q; p < eol; p = q) {
+            while (p < eol && (*p == ' ' || *p == '\t' || *p == '\r'))
+                p++;
+            for (q = p; q < eol && *q != ' ' && *q != '\t' && *q != '\r'; q++)
+                ;
+            if (q > p)
+                v.emplace_back(p, q - p);
+        }
+        if (v.empty() || v[0][0] == '#')
+            continue;
+        key = v[0];
+        v.erase(v.begin());
+        if (key == "keywords" || key == "suffixes" || key == "begin" || key == "end") {
+            std::vector<std::string> &to = (key == "keywords") ? def->keywords :
+                                           (key == "suffixes") ? def->suffixes :
+                                           (key == "begin") ? def->begin : def->end;
+            to.insert(to.end(), v.begin(), v.end());
+        } else if (key == "named-blocks") {
+            if (!v.empty())
+                return "named-blocks takes no value";
+            def->named_blocks = true;
+        } else if (key == "block-comment" || key == "braces") {
+            if (v.size() != 2)
+                return "expected two values";
+            if (key == "braces") {
+                if (v[0].size() != 1 || v[1].size() != 1)
+                    return "braces are single characters";
+                def->braces = v[0] + v[1];
+            } else {
+                if (v[0].size() > 2 || v[1].size() > 2)
+                    return "comment delimiters are one or two characters";
+                def->block_open = v[0];
+                def->block_close = v[1];
+            }
+        } else if (v.size() != 1) {
+            return "expected one value";
+        } else if (key == "language") {
+            def->name = v[0];
+        } else if (key == "word") {
+            def->word = v[0];
+        } else if (key == "strings") {
+            def->strings = v[0];
+        } else if (key == "line-comment") {
+            if (v[0].size() > 2)
+                return "comment delimiters are one or two characters";
+            def->line_comment = v[0];
+        } else if (key == "directive") {
+            if (v[0].size() != 1)
+                return "a directive is one character";
+            def->directive = v[0][0];
+        } else {
+            return "unknown setting";
+        }
+    }
+    if (def->name.empty())
+        return "no language name";
+    return NULL;
+}
+
+/*
+ * read and parse the definition file path; on failure, say why on stderr
+ * (prefixed with prog) and return false
+ */
+static inline bool ReadLanguage(const char *prog, const char *path, std::string *text, lang_source_t *def) {
+    FILE *f;
+    char buf[4096];
+    size_t n;
+    const char *err;
+    int line;
+
+    if ((f = fopen(path, "r")) == NULL) {
+        fprintf(stderr, "%s: can't open '%s' %s\n", prog, path, strerror(errno));
+        return false;
+    }
+    text->clear();
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        text->append(buf, n);
+    fclose(f);
+    if ((err = ParseLanguage(text->data(), text->size(), def, &line)) != NULL) {
+        fprintf(stderr, "%s: %s line %d: %s\n", prog, path, line, err);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * whether name ends in one of suffixes, going by its last '.' as
+ * LanguageForName() does
+ */
+static inline bool HasSuffix(const char *name, const std::vector<std::string> &suffixes) {
+    const char *dotpos = strrchr(name, '.');
+
+    if (dotpos != NULL)
+        for (const std::string &s : suffixes)
+            if (s == dotpos)
+                return true;
+    return false;
+}
+
+/*
+ * Count the pages c2ps makes of one file.  Start() with the page layout
+ * (see PageLayout()) and whether the file is listed as -text, Feed() it
+ * the file in pieces of any size, and Finish() gives the page count,
+ * padded to a multiple of page_skip.
+ *
+ * Only a line's length and the first of '\n', '\r', '\f' or NUL on it
+ * matter: c2ps stops listing a line there, and a '\f' sends the next
+ * line that isn't empty to a new page.  -text lines also wrap every
+ * wrap_col columns, tabs expanded, onto as many more lines as it takes.
+ */
+class Paginator {
+public:
+    void Start(int top_p, int wrap_col_p, int text_mode) {
+        top = top_p;
+        wrap_col = wrap_col_p;
+        text = text_mode;
+        pages = 0;
+        ypos = top;
+        width = 0;
+        started = ended = feed = false;
+    }
+
+    void Feed(const char *p, size_t n) {
+        const char *end = p + n,
+                *q;
+
+        while (p < end) {
+            if (ended) {
+                /* the rest of the line isn't listed */
+                if ((q = (const char *) memchr(p, '\n', end - p)) == NULL)
+                    return;
+                p = q;
+            } else {
+                q = ScanControl(p, end);
+                if (q != p)
+                    started = true;
+                width += q - p;
+                if ((p = q) == end)
+                    return;
+            }
+            switch (*p++) {
+                case '\n':
+                    EndLine();
+                    break;
+                case '\t':
+                    started = true;
+                    width = (width | 7) + 1;
+                    break;
+                case '\f':
+                    feed = true;
+                    /* fall through */
+                case '\r':
+                case '\0':
+                    started = ended = true;
+                    break;
+                default:
+                    started = true;
+                    width++;
+                    break;
+            }
+        }
+    }
+
+    int Finish(int page_skip) {
+        if (started)
+            EndLine();      /* last line without a newline */
+        while (pages % page_skip != 0)
+            pages++;
+        return pages;
+    }
+
+private:
+    int top,
+            wrap_col,
+            text,
+            pages,
+            ypos,
+            width;          /* columns on the current line so far */
+    bool started,           /* the current line isn't empty */
+            ended,          /* and has been cut off */
+            feed;           /* by a '\f' */
+
+    void NextLine() {
+        ypos -= LINEWIDTH;
+        if (ypos < BOTTOM) {
+            pages++;
+            ypos = top;
+        }
+    }
+
+    void EndLine() {
+        if (started) {
+            if (pages == 0) {
+                pages++;
+                ypos = top;
+            }
+            if (ypos < BOTTOM) {
+                pages++;
+                ypos = top;
+            }
+            if (text && width > 0)
+                for (int k = (width - 1) / wrap_col; k > 0; k--)
+                    NextLine();
+        }
+        if (feed)
+            ypos = 0;
+        ypos -= LINEWIDTH;
+        width = 0;
+        started = ended = feed = false;
+    }
+};
+
+#endif /* LAYOUT_H */
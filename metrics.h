@@ -0,0 +1,74 @@
+/*
+ * $Header: metrics.h $
+ *
+ * Character widths from the Adobe font metrics (AFM) of the fonts c2ps
+ * measures text in, so that it can place right-aligned and centered text
+ * and wrap -text lines itself instead of leaving it to stringwidth on the
+ * printer.  Widths are in 1/1000 of the point size.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+
+#define COURIER_WIDTH   600     /* every character of Courier */
+
+/*
+ * Helvetica, which Helvetica-Oblique shares, by character code in
+ * StandardEncoding; 0 for the codes that have no character
+ */
+static constexpr unsigned short helvetica_widths[256] = {
+        /* 0 - 31 */
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        /*   ! " # $ % & ' ( ) * + , - . / */
+        278, 278, 355, 556, 556, 889, 667, 222, 333, 333, 389, 584, 278, 333, 278, 278,
+        /* 0 1 2 3 4 5 6 7 8 9 : ; < = > ? */
+        556, 556, 556, 556, 556, 556, 556, 556, 556, 556, 278, 278, 584, 584, 584, 556,
+        /* @ A B C D E F G H I J K L M N O */
+        1015, 667, 667, 722, 722, 667, 611, 778, 722, 278, 500, 667, 556, 833, 722, 778,
+        /* P Q R S T U V W X Y Z [ \ ] ^ _ */
+        667, 778, 722, 667, 611, 722, 667, 944, 667, 667, 611, 278, 278, 278, 469, 556,
+        /* ` a b c d e f g h i j k l m n o */
+        222, 556, 556, 500, 556, 556, 278, 556, 556, 222, 222, 500, 222, 833, 556, 556,
+        /* p q r s t u v w x y z { | } ~ */
+        556, 556, 333, 500, 278, 556, 500, 722, 500, 500, 500, 334, 260, 334, 584, 0,
+        /* 128 - 159 */
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        /* 160: exclamdown cent sterling fraction yen florin section currency
+         * quotesingle quotedblleft guillemotleft guilsinglleft guilsinglright fi fl */
+        0, 333, 556, 556, 167, 556, 556, 556, 556, 191, 333, 556, 333, 333, 500, 500,
+        /* 176: endash dagger daggerdbl periodcentered paragraph bullet
+         * quotesinglbase quotedblbase quotedblright guillemotright ellipsis
+         * perthousand questiondown */
+        0, 556, 556, 556, 278, 0, 537, 350, 222, 333, 333, 556, 1000, 1000, 0, 611,
+        /* 192: grave acute circumflex tilde macron breve dotaccent dieresis ring
+         * cedilla hungarumlaut ogonek caron */
+        0, 333, 333, 333, 333, 333, 333, 333, 333, 0, 333, 333, 0, 333, 333, 333,
+        /* 208: emdash */
+        1000, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        /* 224: AE ordfeminine Lslash Oslash OE ordmasculine */
+        0, 1000, 0, 370, 0, 0, 0, 0, 556, 778, 1000, 365, 0, 0, 0, 0,
+        /* 240: ae dotlessi lslash oslash oe germandbls */
+        0, 889, 0, 0, 0, 278, 0, 0, 222, 611, 944, 611, 0, 0, 0, 0};
+
+/*
+ * the width of the n characters at s in Helvetica, or -1 if one of them
+ * has no width here
+ */
+static inline int HelveticaWidth(const char *s, size_t n) {
+    int w = 0;
+
+    for (size_t k = 0; k < n; k++) {
+        unsigned short cw = helvetica_widths[(unsigned char) s[k]];
+
+        if (cw == 0)
+            return -1;
+        w += cw;
+    }
+    return w;
+}
+
+#endif /* METRICS_H */
@@ -0,0 +1,171 @@
+/*
+ * $Header: scan.h $
+ *
+ * Byte scans shared by c2ps and count: find the bytes of interest in a
+ * buffer 16 or 32 bytes at a time with SSE2 or AVX2, with a plain loop
+ * for the tail and for machines without them.  Everything here is static
+ * inline so each program just includes it.
+ */
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/*
+ * The bytes c2ps -text has to look at one by one: the control characters
+ * up to '\r' (NUL, tab, newline, formfeed, return and a few that print
+ * like anything else), and '(', ')' and '\\', which need escaping.
+ */
+static inline bool IsTextSpecial(unsigned char c) {
+    return c <= '\r' || (c & 0xFE) == '(' || c == '\\';
+}
+
+/*
+ * the first IsTextSpecial() byte in [p, end), or the first also, or end
+ * if there is neither.  Comments look for '*' this way and strings for
+ * their closing quote.
+ */
+static inline const char *ScanTextSpecialOr(const char *p, const char *end, char also) {
+#ifdef __SSE2__
+    const __m128i cr = _mm_set1_epi8('\r'),
+            paren = _mm_set1_epi8('('),
+            not_low = _mm_set1_epi8((char) 0xFE),
+            bslash = _mm_set1_epi8('\\'),
+            other = _mm_set1_epi8(also);
+
+    for (; end - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) p),
+                m = _mm_or_si128(
+                        _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(v, cr), v),
+                                     _mm_cmpeq_epi8(v, other)),
+                        _mm_or_si128(_mm_cmpeq_epi8(_mm_and_si128(v, not_low), paren),
+                                     _mm_cmpeq_epi8(v, bslash)));
+        int bits = _mm_movemask_epi8(m);
+
+        if (bits != 0)
+            return p + __builtin_ctz(bits);
+    }
+#endif
+    for (; p < end; p++)
+        if (IsTextSpecial((unsigned char) *p) || *p == also)
+            return p;
+    return end;
+}
+
+/*
+ * the first IsTextSpecial() byte in [p, end), or end if there is none
+ */
+static inline const char *ScanTextSpecial(const char *p, const char *end) {
+    return ScanTextSpecialOr(p, end, '\\');
+}
+
+/*
+ * the first control character up to '\r' in [p, end), or end if there is
+ * none: everything that can end a line, start a new page or move to a tab
+ * stop, for the page layout in layout.h
+ */
+static inline const char *ScanControl(const char *p, const char *end) {
+#ifdef __SSE2__
+    const __m128i cr = _mm_set1_epi8('\r');
+
+    for (; end - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) p);
+        int bits = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(v, cr), v));
+
+        if (bits != 0)
+            return p + __builtin_ctz(bits);
+    }
+#endif
+    for (; p < end; p++)
+        if ((unsigned char) *p <= '\r')
+            return p;
+    return end;
+}
+
+/*
+ * Where count has to look: newline, formfeed and tab.  The CountMasks
+ * functions set bit i of masks[k] when p[64 * k + i] is one of them, for
+ * n bytes at p, n a multiple of 64.  CountMasksFor() picks the widest
+ * version the machine running the program has.
+ */
+typedef void CountMasksFn(const char *p, size_t n, uint64_t *masks);
+
+static inline bool IsCountSpecial(unsigned char c) {
+    return c == '\n' || c == '\f' || c == '\t';
+}
+
+static inline void CountMasksScalar(const char *p, size_t n, uint64_t *masks) {
+    for (size_t k = 0; k < n; k += 64) {
+        uint64_t m = 0;
+
+        for (int i = 0; i < 64; i++)
+            m |= (uint64_t) IsCountSpecial((unsigned char) p[k + i]) << i;
+        *masks++ = m;
+    }
+}
+
+#ifdef __SSE2__
+static inline void CountMasksSSE2(const char *p, size_t n, uint64_t *masks) {
+    const __m128i nl = _mm_set1_epi8('\n'),
+            ff = _mm_set1_epi8('\f'),
+            tab = _mm_set1_epi8('\t');
+
+    for (size_t k = 0; k < n; k += 64) {
+        uint64_t m = 0;
+
+        for (int i = 0; i < 64; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *) (p + k + i));
+
+            m |= (uint64_t) (unsigned) _mm_movemask_epi8(
+                    _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, nl), _mm_cmpeq_epi8(v, ff)),
+                                 _mm_cmpeq_epi8(v, tab))) << i;
+        }
+        *masks++ = m;
+    }
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static inline void CountMasksAVX2(const char *p, size_t n, uint64_t *masks) {
+    const __m256i nl = _mm256_set1_epi8('\n'),
+            ff = _mm256_set1_epi8('\f'),
+            tab = _mm256_set1_epi8('\t');
+
+    for (size_t k = 0; k < n; k += 64) {
+        __m256i lo = _mm256_loadu_si256((const __m256i *) (p + k)),
+                hi = _mm256_loadu_si256((const __m256i *) (p + k + 32));
+        uint32_t mlo = _mm256_movemask_epi8(
+                _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(lo, nl), _mm256_cmpeq_epi8(lo, ff)),
+                                _mm256_cmpeq_epi8(lo, tab))),
+                mhi = _mm256_movemask_epi8(
+                _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(hi, nl), _mm256_cmpeq_epi8(hi, ff)),
+                                _mm256_cmpeq_epi8(hi, tab)));
+
+        *masks++ = (uint64_t) mhi << 32 | mlo;
+    }
+}
+#endif
+
+static inline CountMasksFn *CountMasksFor() {
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2"))
+        return CountMasksAVX2;
+#endif
+#ifdef __SSE2__
+    return CountMasksSSE2;
+#else
+    return CountMasksScalar;
+#endif
+}
+
+#endif /* SCAN_H */